@@ -33,6 +33,10 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+#if defined(USE_THREAD)
+#include <pthread.h>
+#endif
+
 #if defined(__TINYC__)
 /* TCC has __atomic_exchange() for gcc's __atomic_exchange_n(). However it does
  * not have any barrier, so we're forcing the order to the stricter SEQ_CST
@@ -42,6 +46,7 @@
  */
 #include <stdatomic.h>
 #define __atomic_exchange_n(val, new, order) __atomic_exchange(val, new, __ATOMIC_SEQ_CST)
+#define __atomic_load_n(val, order) __atomic_load(val, __ATOMIC_SEQ_CST)
 #define __atomic_thread_fence(order) do { } while (0)
 #define __thread
 
@@ -62,6 +67,7 @@
 		         mt_list_cpu_relax1());				\
 		__old_xchg;						\
 	})
+#define __atomic_load_n(val, order) (*(volatile typeof(*(val)) *)(val))
 #define __atomic_thread_fence(order) do { } while (0)
 #endif
 
@@ -74,6 +80,17 @@
 #define MT_UNREACHABLE() do { } while (0)
 #endif
 
+/* The state of the opt-in debugging facilities is declared weak so that all
+ * the compilation units of a program which include this file share a single
+ * copy of it. Compilers which don't support weak symbols get one copy per
+ * compilation unit instead.
+ */
+#if defined(__GNUC__) || defined(__clang__) || defined(__TINYC__)
+#define MT_SHARED __attribute__((weak))
+#else
+#define MT_SHARED static
+#endif
+
 /* set NOINLINE to forcefully disable user functions inlining */
 #if defined(NOINLINE)
 #define MT_INLINE __attribute__((noinline))
@@ -154,6 +171,18 @@ struct mt_list {
 		(_n ? MT_LIST_ELEM(_n, t, m) : NULL);			\
 	})
 
+/* Same as MT_LIST_POP() except that the first element is only detached if
+ * predicate <pred> called with the element and <ctx> returns non-zero. See
+ * mt_list_pop_if() for the predicate's constraints. Example:
+ *
+ *   while ((task = MT_LIST_POP_IF(timers, struct task *, list, expired, &now))) ...
+ */
+#define MT_LIST_POP_IF(lh, t, m, pred, ctx)				\
+	({								\
+		struct mt_list *_n = mt_list_pop_if(lh, pred, ctx);	\
+		(_n ? MT_LIST_ELEM(_n, t, m) : NULL);			\
+	})
+
 /* Iterates <item> through a list of items of type "typeof(*item)" which are
  * linked via a "struct mt_list" member named <member>. A pointer to the head
  * of the list is passed in <list_head>.
@@ -217,6 +246,1083 @@ struct mt_list {
 #define MT_LIST_LOCK_FULL(el)           (mt_list_lock_full(el))
 #define MT_LIST_UNLOCK_LINK(ends)       (mt_list_unlock_link(ends))
 #define MT_LIST_UNLOCK_FULL(el, ends)   (mt_list_unlock_full(el, ends))
+#define MT_LIST_MOVE(e, l)              (mt_list_move(e, l))
+#define MT_LIST_CUT(l, e, t)            (mt_list_cut(l, e, t))
+#define MT_LIST_MERGE(d, s)             (mt_list_merge(d, s))
+#define MT_LIST_SORT(l, c, n)           (mt_list_sort(l, c, n))
+
+
+/* Operation identifiers, used by tracing (mt_list_trace_ev.op) and by delay
+ * injection points.
+ */
+#define MT_LIST_TR_TRY_INSERT   1
+#define MT_LIST_TR_TRY_APPEND   2
+#define MT_LIST_TR_BEHEAD       3
+#define MT_LIST_TR_INSERT       4
+#define MT_LIST_TR_APPEND       5
+#define MT_LIST_TR_DELETE       6
+#define MT_LIST_TR_POP          7
+#define MT_LIST_TR_POP_IF       8
+#define MT_LIST_TR_CUT          9
+#define MT_LIST_TR_MERGE       10
+#define MT_LIST_TR_LOCK_NEXT   11
+#define MT_LIST_TR_LOCK_PREV   12
+#define MT_LIST_TR_LOCK_ELEM   13
+#define MT_LIST_TR_LOCK_FULL   14
+#define MT_LIST_TR_APPLY       15
+#define MT_LIST_TR_WALK        16  /* one step of an iterator or walk */
+#define MT_LIST_TR_OPS         17  /* number of types, keep last */
+
+/* Delay injection. When MT_LIST_DELAY is defined, each operation calls
+ * mt_list_delay_hook() if it is set, with the operation's identifier, at the
+ * point where all its locks are held, just before it starts to release them.
+ * The lock functions call it once the locks are taken, so that it is also
+ * called while the caller holds the locks, and the iterators call it for each
+ * element, while the previous one is still locked. This allows a test program
+ * to simulate slow lock holders (preemption, interrupts, slow payload work)
+ * with controlled delays, in order to evaluate how back-off and arbitration
+ * strategies behave. The hook must not perform any list operation. It is
+ * shared by all compilation units, so that setting it once affects the whole
+ * program. When MT_LIST_DELAY is not defined, the injection points are empty.
+ */
+#if defined(MT_LIST_DELAY)
+MT_SHARED void (*mt_list_delay_hook)(unsigned int op);
+
+#define MT_LIST_DELAY_POINT(op)						\
+	do {								\
+		if (mt_list_delay_hook)					\
+			mt_list_delay_hook(op);				\
+	} while (0)
+#else
+#define MT_LIST_DELAY_POINT(op) do { } while (0)
+#endif
+
+
+/* Operation tracing. When MT_LIST_TRACE is defined, each thread records one
+ * compact event per list operation into its own ring buffer: the operation
+ * type, the list element it was applied to, the number of retries it took and
+ * a timestamp. Recording only consists in a few stores to thread-local memory
+ * and a cycle counter read, so that it may be enabled on production canaries.
+ * The buffers may then be dumped into a file using mt_list_trace_dump() and
+ * analysed offline with tests/trace-decode.c. When MT_LIST_TRACE is not
+ * defined, nothing is recorded and none of this is built. The buffers are
+ * shared by all compilation units, so that a single dump covers the whole
+ * program, provided that they are all built with the same MT_LIST_TRACE_*
+ * settings.
+ */
+#if defined(MT_LIST_TRACE)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* number of events per thread, must be a power of two */
+#ifndef MT_LIST_TRACE_SIZE
+#define MT_LIST_TRACE_SIZE 4096
+#endif
+
+/* maximum number of threads recording events */
+#ifndef MT_LIST_TRACE_MAX_THREADS
+#define MT_LIST_TRACE_MAX_THREADS 256
+#endif
+
+/* Clock used for the timestamps (mt_list_trace_hdr.clock) */
+#define MT_LIST_TR_CLK_NS       0  /* nanoseconds (CLOCK_MONOTONIC) */
+#define MT_LIST_TR_CLK_TSC      1  /* x86 TSC cycles */
+#define MT_LIST_TR_CLK_CNTVCT   2  /* ARMv8 virtual counter ticks */
+
+/* One recorded event. <addr> is the element passed to the operation (or the
+ * list head), and <retries> the number of back-offs it had to perform.
+ */
+struct mt_list_trace_ev {
+	uint64_t ts;         /* timestamp at the end of the operation */
+	uint64_t addr;       /* element or head address */
+	uint32_t op;         /* MT_LIST_TR_* */
+	uint32_t retries;    /* number of back-offs */
+};
+
+/* File header written by mt_list_trace_dump(). It is followed by <threads>
+ * blocks, each made of a mt_list_trace_thr header followed by its <count>
+ * events in chronological order. All fields are in host byte order.
+ */
+struct mt_list_trace_hdr {
+	char magic[8];       /* "MTLTRACE" */
+	uint32_t version;    /* 1 */
+	uint32_t clock;      /* MT_LIST_TR_CLK_* */
+	uint32_t threads;    /* number of thread blocks */
+	uint32_t ev_size;    /* sizeof(struct mt_list_trace_ev) */
+};
+
+struct mt_list_trace_thr {
+	uint32_t thread;     /* registration order of the thread */
+	uint32_t count;      /* number of events that follow */
+	uint64_t total;      /* events recorded since start, including lost ones */
+};
+
+/* per-thread ring buffer */
+struct _mt_list_trace_buf {
+	uint64_t pos;                 /* total number of events recorded */
+	struct mt_list_trace_ev ev[MT_LIST_TRACE_SIZE];
+};
+
+MT_SHARED struct _mt_list_trace_buf *_mt_list_trace_bufs[MT_LIST_TRACE_MAX_THREADS];
+MT_SHARED unsigned int _mt_list_trace_nbbufs;
+MT_SHARED __thread struct _mt_list_trace_buf *_mt_list_trace_buf;
+MT_SHARED __thread unsigned int _mt_list_trace_retries;
+
+/* context of the operation being traced, recorded when leaving its scope */
+struct _mt_list_trace_ctx {
+	const void *addr;
+	unsigned int op;
+	unsigned int retries;
+};
+
+/* Returns the current timestamp, in units of MT_LIST_TR_CLK */
+static inline __attribute__((always_inline)) uint64_t mt_list_trace_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+#define MT_LIST_TR_CLK MT_LIST_TR_CLK_TSC
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+#define MT_LIST_TR_CLK MT_LIST_TR_CLK_CNTVCT
+	uint64_t cnt;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r"(cnt));
+	return cnt;
+#else
+#define MT_LIST_TR_CLK MT_LIST_TR_CLK_NS
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Allocates and registers the calling thread's ring buffer. Returns NULL if
+ * the thread cannot record events, in which case it will not try again.
+ */
+static struct _mt_list_trace_buf *_mt_list_trace_alloc()
+{
+	struct _mt_list_trace_buf *buf;
+	unsigned int slot;
+
+	buf = (struct _mt_list_trace_buf *)calloc(1, sizeof(*buf));
+	if (!buf)
+		goto fail;
+
+	slot = __atomic_fetch_add(&_mt_list_trace_nbbufs, 1, __ATOMIC_RELAXED);
+	if (slot >= MT_LIST_TRACE_MAX_THREADS) {
+		free(buf);
+		goto fail;
+	}
+	__atomic_store_n(&_mt_list_trace_bufs[slot], buf, __ATOMIC_RELEASE);
+	return _mt_list_trace_buf = buf;
+ fail:
+	_mt_list_trace_buf = (struct _mt_list_trace_buf *)MT_LIST_BUSY;
+	return NULL;
+}
+
+/* Records the event described by <ctx> into the thread's ring buffer. It is
+ * called automatically when leaving the scope of MT_LIST_TRACE_OP().
+ */
+static inline void _mt_list_trace_leave(const struct _mt_list_trace_ctx *ctx)
+{
+	struct _mt_list_trace_buf *buf = _mt_list_trace_buf;
+	struct mt_list_trace_ev *ev;
+
+	if (__builtin_expect(!buf, 0))
+		buf = _mt_list_trace_alloc();
+	if (__builtin_expect(buf == NULL || buf == (void *)MT_LIST_BUSY, 0))
+		return;
+
+	ev = &buf->ev[buf->pos & (MT_LIST_TRACE_SIZE - 1)];
+	ev->ts      = mt_list_trace_now();
+	ev->addr    = (uintptr_t)ctx->addr;
+	ev->op      = ctx->op;
+	ev->retries = _mt_list_trace_retries - ctx->retries;
+	__atomic_store_n(&buf->pos, buf->pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Starts tracing operation <op> on element <el> until the end of the current
+ * scope. It must be placed after the function's declarations.
+ */
+#define MT_LIST_TRACE_OP(op, el)						\
+	const struct _mt_list_trace_ctx _mt_list_trace_ctx			\
+	__attribute__((cleanup(_mt_list_trace_leave))) =			\
+		{ (el), (op), _mt_list_trace_retries }
+
+/* Counts one back-off for the operation in progress */
+#define MT_LIST_TRACE_RETRY() (_mt_list_trace_retries++)
+
+/* Dumps the events recorded by all threads into file <path>, in the format
+ * described by struct mt_list_trace_hdr. Threads may continue to record
+ * events during the dump, though events recorded at this moment may then be
+ * reported inconsistently. Returns 0 on success, or -1 on error with errno
+ * set. Example:
+ *
+ *   if (mt_list_trace_dump("/tmp/mtlist.trace") < 0)
+ *       perror("mt_list_trace_dump");
+ */
+static inline int mt_list_trace_dump(const char *path)
+{
+	struct mt_list_trace_hdr hdr;
+	struct mt_list_trace_thr thr;
+	struct _mt_list_trace_buf *buf;
+	unsigned int nb, i;
+	uint64_t pos, start;
+	FILE *f;
+
+	nb = __atomic_load_n(&_mt_list_trace_nbbufs, __ATOMIC_ACQUIRE);
+	if (nb > MT_LIST_TRACE_MAX_THREADS)
+		nb = MT_LIST_TRACE_MAX_THREADS;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "MTLTRACE", 8);
+	hdr.version = 1;
+	hdr.clock   = MT_LIST_TR_CLK;
+	hdr.ev_size = sizeof(struct mt_list_trace_ev);
+	for (i = 0; i < nb; i++)
+		hdr.threads += !!__atomic_load_n(&_mt_list_trace_bufs[i], __ATOMIC_ACQUIRE);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for (i = 0; i < nb; i++) {
+		buf = __atomic_load_n(&_mt_list_trace_bufs[i], __ATOMIC_ACQUIRE);
+		if (!buf)
+			continue;
+
+		pos = __atomic_load_n(&buf->pos, __ATOMIC_ACQUIRE);
+		start = pos > MT_LIST_TRACE_SIZE ? pos - MT_LIST_TRACE_SIZE : 0;
+
+		thr.thread = i;
+		thr.count  = pos - start;
+		thr.total  = pos;
+		fwrite(&thr, sizeof(thr), 1, f);
+
+		/* the ring may wrap, write the oldest part first */
+		if ((start & (MT_LIST_TRACE_SIZE - 1)) + thr.count > MT_LIST_TRACE_SIZE) {
+			fwrite(&buf->ev[start & (MT_LIST_TRACE_SIZE - 1)], sizeof(buf->ev[0]),
+			       MT_LIST_TRACE_SIZE - (start & (MT_LIST_TRACE_SIZE - 1)), f);
+			fwrite(&buf->ev[0], sizeof(buf->ev[0]), pos & (MT_LIST_TRACE_SIZE - 1), f);
+		}
+		else
+			fwrite(&buf->ev[start & (MT_LIST_TRACE_SIZE - 1)], sizeof(buf->ev[0]), thr.count, f);
+	}
+
+	if (ferror(f)) {
+		fclose(f);
+		return -1;
+	}
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+#else /* !MT_LIST_TRACE */
+
+#define MT_LIST_TRACE_OP(op, el) do { } while (0)
+#define MT_LIST_TRACE_RETRY()    do { } while (0)
+
+#endif /* MT_LIST_TRACE */
+
+
+/* Lock hold-time tracking. When MT_LIST_HOLD is defined, the time during which
+ * locks are held by the caller is measured and accounted to the call site
+ * (source file and line) which took them:
+ *   - from mt_list_lock_next(), mt_list_lock_prev(), mt_list_lock_elem() or
+ *     mt_list_lock_full() to the matching mt_list_unlock_link(),
+ *     mt_list_unlock_full() or mt_list_unlock_elem() ;
+ *   - for each step of the iterators and of mt_list_foreach(), the time spent
+ *     in the loop's body or callback with the element locked, accounted to the
+ *     line of the iterator or of the call.
+ * Each site keeps its number of holds, their total and maximum durations and
+ * a log2 histogram from which mt_list_hold_dump() reports percentiles. When
+ * mt_list_hold_threshold is set (in ns), holds lasting at least this long are
+ * reported to mt_list_hold_hook() if it is set, otherwise on stderr. Locks are
+ * matched with their unlock by the address of the prev end of the link, and up
+ * to MT_LIST_HOLD_DEPTH locks or nested iterators may be tracked per thread.
+ * This costs two clock reads and a few atomic increments per hold, so that it
+ * is meant for debugging and profiling sessions. The statistics and the
+ * tracked holds are shared by all compilation units, so that a hold may end in
+ * another file than the one which started it. When MT_LIST_HOLD is not
+ * defined, nothing is measured.
+ */
+#if defined(MT_LIST_HOLD)
+#include <stdio.h>
+#include <time.h>
+
+/* maximum number of locks and iterators tracked per thread */
+#ifndef MT_LIST_HOLD_DEPTH
+#define MT_LIST_HOLD_DEPTH 8
+#endif
+
+/* maximum number of call sites, must be a power of two */
+#ifndef MT_LIST_HOLD_SITES
+#define MT_LIST_HOLD_SITES 256
+#endif
+
+/* hold times are accounted in buckets of powers of two nanoseconds */
+#define MT_LIST_HOLD_BUCKETS 40
+
+#define _MT_LIST_STR2(x) #x
+#define _MT_LIST_STR(x)  _MT_LIST_STR2(x)
+
+/* call site designation, as a constant string "file:line" */
+#define MT_LIST_HOLD_SITE() (__FILE__ ":" _MT_LIST_STR(__LINE__))
+
+/* statistics of one call site */
+struct mt_list_hold_stat {
+	const char *site;
+	uint64_t count;
+	uint64_t total;      /* ns */
+	uint64_t max;        /* ns */
+	uint64_t hist[MT_LIST_HOLD_BUCKETS];
+};
+
+MT_SHARED struct mt_list_hold_stat _mt_list_hold_stats[MT_LIST_HOLD_SITES];
+MT_SHARED uint64_t mt_list_hold_threshold;
+MT_SHARED void (*mt_list_hold_hook)(const char *site, uint64_t ns);
+
+/* locks and iterators in progress in the current thread */
+MT_SHARED __thread struct {
+	const void *key;     /* prev end of the locked link, NULL for iterators */
+	const char *site;
+	uint64_t start;      /* 0 for iterators before their first element */
+} _mt_list_hold_cur[MT_LIST_HOLD_DEPTH];
+MT_SHARED __thread unsigned int _mt_list_hold_nbcur;
+MT_SHARED __thread unsigned int _mt_list_hold_lost; /* untracked nested iterators */
+MT_SHARED __thread const char *_mt_list_hold_site;
+
+static inline uint64_t _mt_list_hold_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Accounts a hold of <ns> nanoseconds to call site <site> */
+static void _mt_list_hold_account(const char *site, uint64_t ns)
+{
+	struct mt_list_hold_stat *st;
+	const char *old;
+	uint64_t max, v;
+	unsigned int i, b;
+
+	/* sites are constant strings, their address identifies them */
+	i = ((uintptr_t)site >> 3) * 0x9E3779B1U;
+	for (b = 0; b < MT_LIST_HOLD_SITES; b++, i++) {
+		st = &_mt_list_hold_stats[i & (MT_LIST_HOLD_SITES - 1)];
+		old = __atomic_load_n(&st->site, __ATOMIC_ACQUIRE);
+		if (old == site)
+			break;
+		if (!old && __atomic_compare_exchange_n(&st->site, &old, site, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			break;
+		if (old == site)
+			break;
+	}
+	if (b == MT_LIST_HOLD_SITES)
+		return;
+
+	for (b = 0, v = ns; v > 1 && b < MT_LIST_HOLD_BUCKETS - 1; b++)
+		v = (v + 1) >> 1;
+	__atomic_fetch_add(&st->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->total, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->hist[b], 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&st->max, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&st->max, &max, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	if (mt_list_hold_threshold && ns >= mt_list_hold_threshold) {
+		if (mt_list_hold_hook)
+			mt_list_hold_hook(site, ns);
+		else
+			fprintf(stderr, "mt_list: lock held for %llu ns at %s\n", (unsigned long long)ns, site);
+	}
+}
+
+/* Starts a hold on the link whose prev end is <key>, for the call site which
+ * was designated before calling the lock function.
+ */
+static inline void _mt_list_hold_begin(const void *key)
+{
+	unsigned int n = _mt_list_hold_nbcur;
+
+	if (n < MT_LIST_HOLD_DEPTH) {
+		_mt_list_hold_cur[n].key   = key;
+		_mt_list_hold_cur[n].site  = _mt_list_hold_site ? _mt_list_hold_site : "unknown";
+		_mt_list_hold_cur[n].start = _mt_list_hold_now();
+		_mt_list_hold_nbcur = n + 1;
+	}
+	_mt_list_hold_site = NULL;
+}
+
+/* Ends the hold on the link whose prev end is <key>, if any */
+static inline void _mt_list_hold_end(const void *key)
+{
+	unsigned int n = _mt_list_hold_nbcur;
+	uint64_t ns;
+
+	while (n--) {
+		if (_mt_list_hold_cur[n].key != key)
+			continue;
+		ns = _mt_list_hold_now() - _mt_list_hold_cur[n].start;
+		_mt_list_hold_account(_mt_list_hold_cur[n].site, ns);
+		/* keep the entries in order */
+		for (_mt_list_hold_nbcur--; n < _mt_list_hold_nbcur; n++)
+			_mt_list_hold_cur[n] = _mt_list_hold_cur[n + 1];
+		break;
+	}
+}
+
+/* Starts tracking an iterator for call site <site> */
+static inline void _mt_list_hold_iter_begin(const char *site)
+{
+	unsigned int n = _mt_list_hold_nbcur;
+
+	if (_mt_list_hold_lost || n >= MT_LIST_HOLD_DEPTH) {
+		_mt_list_hold_lost++;
+		return;
+	}
+	_mt_list_hold_cur[n].key   = NULL;
+	_mt_list_hold_cur[n].site  = site;
+	_mt_list_hold_cur[n].start = 0;
+	_mt_list_hold_nbcur = n + 1;
+}
+
+/* Starts tracking an iterating function for the call site which was designated
+ * before calling it.
+ */
+static inline void _mt_list_hold_call_begin()
+{
+	_mt_list_hold_iter_begin(_mt_list_hold_site ? _mt_list_hold_site : "unknown");
+	_mt_list_hold_site = NULL;
+}
+
+/* Returns the slot of the innermost iterator, or -1 if it is not tracked */
+static inline int _mt_list_hold_iter_slot()
+{
+	int n = _mt_list_hold_nbcur;
+
+	while (--n >= 0 && _mt_list_hold_cur[n].key)
+		;
+	return n;
+}
+
+/* Accounts the previous step of the innermost iterator, and starts the next
+ * one if <next> is set, otherwise stops tracking it.
+ */
+static inline void _mt_list_hold_iter_step(int next)
+{
+	int n = _mt_list_hold_iter_slot();
+	uint64_t now;
+
+	if (_mt_list_hold_lost) {
+		/* the innermost iterator is not tracked */
+		_mt_list_hold_lost -= !next;
+		return;
+	}
+	if (n < 0)
+		return;
+
+	now = _mt_list_hold_now();
+	if (_mt_list_hold_cur[n].start)
+		_mt_list_hold_account(_mt_list_hold_cur[n].site, now - _mt_list_hold_cur[n].start);
+	_mt_list_hold_cur[n].start = now;
+
+	if (!next) {
+		for (_mt_list_hold_nbcur--; n < (int)_mt_list_hold_nbcur; n++)
+			_mt_list_hold_cur[n] = _mt_list_hold_cur[n + 1];
+	}
+}
+
+#define MT_LIST_HOLD_BEGIN(key)      _mt_list_hold_begin(key)
+#define MT_LIST_HOLD_END(key)        _mt_list_hold_end(key)
+#define MT_LIST_HOLD_ITER_BEGIN()    _mt_list_hold_iter_begin(MT_LIST_HOLD_SITE())
+#define MT_LIST_HOLD_ITER_STEP()     _mt_list_hold_iter_step(1)
+#define MT_LIST_HOLD_ITER_END()      _mt_list_hold_iter_step(0)
+#define MT_LIST_HOLD_CALL_BEGIN()    _mt_list_hold_call_begin()
+
+/* Prints the statistics of all call sites to <out>: number of holds, average,
+ * 50th, 99th and 99.9th percentiles (upper bound of their log2 bucket) and
+ * maximum hold times in nanoseconds. Example:
+ *
+ *   mt_list_hold_dump(stderr);
+ */
+static inline void mt_list_hold_dump(FILE *out)
+{
+	const struct mt_list_hold_stat *st;
+	static const double pct[3] = { 50.0, 99.0, 99.9 };
+	uint64_t p[3], cumul;
+	unsigned int i, b, k;
+
+	fprintf(out, "%-32s %12s %10s %10s %10s %10s %12s\n",
+	        "site", "holds", "avg_ns", "p50_ns", "p99_ns", "p999_ns", "max_ns");
+	for (i = 0; i < MT_LIST_HOLD_SITES; i++) {
+		st = &_mt_list_hold_stats[i];
+		if (!st->site || !st->count)
+			continue;
+		for (k = 0; k < 3; k++) {
+			for (b = 0, cumul = 0; b < MT_LIST_HOLD_BUCKETS - 1; b++) {
+				cumul += st->hist[b];
+				if (cumul * 100.0 >= st->count * pct[k])
+					break;
+			}
+			p[k] = 1ULL << b;
+		}
+		fprintf(out, "%-32s %12llu %10llu %10llu %10llu %10llu %12llu\n", st->site,
+		        (unsigned long long)st->count, (unsigned long long)(st->total / st->count),
+		        (unsigned long long)p[0], (unsigned long long)p[1], (unsigned long long)p[2],
+		        (unsigned long long)st->max);
+	}
+}
+
+#else /* !MT_LIST_HOLD */
+
+#define MT_LIST_HOLD_BEGIN(key)      do { } while (0)
+#define MT_LIST_HOLD_END(key)        do { } while (0)
+#define MT_LIST_HOLD_ITER_BEGIN()    ((void)0)
+#define MT_LIST_HOLD_ITER_STEP()     ((void)0)
+#define MT_LIST_HOLD_ITER_END()      ((void)0)
+#define MT_LIST_HOLD_CALL_BEGIN()    ((void)0)
+
+#endif /* MT_LIST_HOLD */
+
+
+/* Stuck-lock watchdog. When MT_LIST_WATCHDOG is defined, each thread notes the
+ * operation it is performing and the element or head it applies to, and the
+ * retry loops measure the time spent spinning. Once an operation has spun for
+ * mt_list_watchdog_ns nanoseconds (1 second by default), it is reported to
+ * mt_list_watchdog_hook() if it is set, otherwise on stderr, then again after
+ * each new period for as long as it keeps spinning. This turns a forgotten
+ * unlock (e.g. a return from inside an iterator) into an actionable report
+ * instead of threads silently burning CPU. The clock is only read once the
+ * operation has retried MT_LIST_WATCHDOG_RETRIES times, so that short
+ * contention only costs a counter increment per retry. The time spent in
+ * these first retries, well below a millisecond, is not counted. The lock
+ * functions and the iterators also tag the elements they lock with the
+ * locking thread's number into a small hashed table, so that the report can
+ * name the last thread known to have locked the element the spinning thread
+ * is waiting for. Tags are hints only: they may be overwritten by other
+ * elements sharing the same slot. Threads are numbered from 1 in the order
+ * they first lock an element or get reported. The settings, the tags and the
+ * thread numbers are shared by all compilation units. The hook is called from
+ * the spinning thread and must not perform any list operation. When
+ * MT_LIST_WATCHDOG is not defined, nothing is built.
+ */
+#if defined(MT_LIST_WATCHDOG)
+#include <stdio.h>
+#include <time.h>
+
+/* number of owner tags, must be a power of two */
+#ifndef MT_LIST_WATCHDOG_TAGS
+#define MT_LIST_WATCHDOG_TAGS 4096
+#endif
+
+/* number of retries of an operation before the clock starts to be read */
+#ifndef MT_LIST_WATCHDOG_RETRIES
+#define MT_LIST_WATCHDOG_RETRIES 4
+#endif
+
+/* description of a stuck operation passed to mt_list_watchdog_hook() */
+struct mt_list_stuck {
+	const void *addr;      /* element or head passed to the operation */
+	unsigned int op;       /* MT_LIST_TR_* */
+	unsigned int thread;   /* number of the spinning thread */
+	unsigned int owner;    /* last thread which locked <addr>, 0 if unknown */
+	uint64_t ns;           /* time spent spinning so far */
+};
+
+MT_SHARED uint64_t mt_list_watchdog_ns = 1000000000ULL;
+MT_SHARED void (*mt_list_watchdog_hook)(const struct mt_list_stuck *stuck);
+
+MT_SHARED struct {
+	const void *addr;
+	unsigned int owner;
+} _mt_list_wd_tags[MT_LIST_WATCHDOG_TAGS];
+MT_SHARED unsigned int _mt_list_wd_threads;
+
+MT_SHARED __thread unsigned int _mt_list_wd_thread;
+MT_SHARED __thread unsigned int _mt_list_wd_op;
+MT_SHARED __thread unsigned int _mt_list_wd_retries;
+MT_SHARED __thread const void *_mt_list_wd_addr;
+MT_SHARED __thread uint64_t _mt_list_wd_start;   /* 0 when not spinning */
+MT_SHARED __thread uint64_t _mt_list_wd_next;    /* date of the next report */
+
+static inline uint64_t _mt_list_wd_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* returns the calling thread's number, assigning it on first call */
+static inline unsigned int _mt_list_wd_self()
+{
+	if (__builtin_expect(!_mt_list_wd_thread, 0))
+		_mt_list_wd_thread = __atomic_add_fetch(&_mt_list_wd_threads, 1, __ATOMIC_RELAXED);
+	return _mt_list_wd_thread;
+}
+
+/* returns the tag slot for element <el> */
+static inline unsigned int _mt_list_wd_slot(const void *el)
+{
+	return (((uintptr_t)el >> 4) * 0x9E3779B1U) & (MT_LIST_WATCHDOG_TAGS - 1);
+}
+
+/* Notes that the calling thread locked element <el> */
+static inline void _mt_list_wd_tag(const void *el)
+{
+	unsigned int slot = _mt_list_wd_slot(el);
+
+	__atomic_store_n(&_mt_list_wd_tags[slot].addr, el, __ATOMIC_RELAXED);
+	__atomic_store_n(&_mt_list_wd_tags[slot].owner, _mt_list_wd_self(), __ATOMIC_RELAXED);
+}
+
+/* Called for each retry of the current operation past the first
+ * MT_LIST_WATCHDOG_RETRIES ones. Reports it once it has been spinning for too
+ * long.
+ */
+static void _mt_list_wd_retry()
+{
+	struct mt_list_stuck stuck;
+	unsigned int slot;
+	uint64_t now;
+
+	now = _mt_list_wd_now();
+	if (!_mt_list_wd_start) {
+		_mt_list_wd_start = now;
+		_mt_list_wd_next = now + mt_list_watchdog_ns;
+		return;
+	}
+	if (now < _mt_list_wd_next)
+		return;
+	_mt_list_wd_next = now + mt_list_watchdog_ns;
+
+	slot = _mt_list_wd_slot(_mt_list_wd_addr);
+	stuck.addr   = _mt_list_wd_addr;
+	stuck.op     = _mt_list_wd_op;
+	stuck.thread = _mt_list_wd_self();
+	stuck.owner  = 0;
+	stuck.ns     = now - _mt_list_wd_start;
+	if (__atomic_load_n(&_mt_list_wd_tags[slot].addr, __ATOMIC_RELAXED) == stuck.addr)
+		stuck.owner = __atomic_load_n(&_mt_list_wd_tags[slot].owner, __ATOMIC_RELAXED);
+
+	if (mt_list_watchdog_hook)
+		mt_list_watchdog_hook(&stuck);
+	else
+		fprintf(stderr, "mt_list: thread %u stuck for %llu ms in operation %u on %p (last locked by thread %u)\n",
+		        stuck.thread, (unsigned long long)(stuck.ns / 1000000), stuck.op, stuck.addr, stuck.owner);
+}
+
+/* Starts watching operation <op> on element <el>. It must be placed after the
+ * function's declarations.
+ */
+#define MT_LIST_WATCH_OP(op, el)					\
+	do {								\
+		_mt_list_wd_op = (op);					\
+		_mt_list_wd_addr = (el);				\
+		_mt_list_wd_retries = 0;				\
+		_mt_list_wd_start = 0;					\
+	} while (0)
+
+#define MT_LIST_WATCH_RETRY()						\
+	do {								\
+		if (_mt_list_wd_retries < MT_LIST_WATCHDOG_RETRIES)	\
+			_mt_list_wd_retries++;				\
+		else							\
+			_mt_list_wd_retry();				\
+	} while (0)
+
+#define MT_LIST_WATCH_LOCKED(el) _mt_list_wd_tag(el)
+
+#else /* !MT_LIST_WATCHDOG */
+
+#define MT_LIST_WATCH_OP(op, el) do { } while (0)
+#define MT_LIST_WATCH_RETRY()    do { } while (0)
+#define MT_LIST_WATCH_LOCKED(el) do { } while (0)
+
+#endif /* MT_LIST_WATCHDOG */
+
+
+/* Statistics export. When MT_LIST_STATS is defined, lists registered with
+ * mt_list_stats_register() under a name get their own counters: number of
+ * operations of each type applied to their head, number of retries and time
+ * spent in back-off by these operations, and an estimate of their length,
+ * which is the number of elements added minus the number of elements popped
+ * (it is reset by mt_list_behead(), and elements removed by mt_list_delete()
+ * are not accounted since their list is not known). Operations applied to an
+ * element rather than to a head (e.g. mt_list_delete(), mt_list_lock_full())
+ * are not accounted either. Each thread has its own copy of the counters,
+ * allocated on its first accounted operation and never released, which it
+ * updates with plain stores, and it remembers the last head it looked up, so
+ * that repeated operations on the same list neither hash its address nor
+ * write to shared cache lines. mt_list_stats_export() creates a POSIX shared
+ * memory segment that mt_list_stats_publish() updates with the sum of all
+ * threads' counters, protected by a sequence number that is odd during the
+ * update, so that a reader in another process (e.g. tests/stats-reader.c)
+ * takes consistent snapshots without interacting with the monitored process.
+ * The publication is meant to be called periodically from a housekeeping
+ * thread. Lists remain registered for the life of the process. The registry
+ * and the counters are shared by all compilation units. When MT_LIST_STATS is
+ * not defined, nothing is built.
+ */
+#if defined(MT_LIST_STATS)
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* maximum number of registered lists, must be a power of two */
+#ifndef MT_LIST_STATS_MAX
+#define MT_LIST_STATS_MAX 64
+#endif
+
+/* maximum number of threads whose operations are accounted */
+#ifndef MT_LIST_STATS_MAX_THREADS
+#define MT_LIST_STATS_MAX_THREADS 256
+#endif
+
+#define MT_LIST_STATS_NAME_LEN 32
+
+/* counters of one list, as found in the shared memory segment */
+struct mt_list_stats {
+	char name[MT_LIST_STATS_NAME_LEN];
+	uint64_t ops[MT_LIST_TR_OPS];   /* per MT_LIST_TR_* type */
+	uint64_t retries;               /* number of back-offs */
+	uint64_t backoff_ns;            /* time spent in back-off */
+	int64_t length;                 /* length estimate */
+};
+
+/* Shared memory segment header. It is followed by <lists> mt_list_stats. The
+ * <seq> field is odd while the segment is being updated: a reader must read
+ * it, copy the contents, then check that it is even and unchanged, or retry.
+ */
+struct mt_list_stats_shm {
+	char magic[8];                  /* "MTLSTATS" */
+	uint32_t version;               /* 1 */
+	uint32_t lists;                 /* number of mt_list_stats that follow */
+	uint32_t ops;                   /* MT_LIST_TR_OPS */
+	uint32_t pid;                   /* exporting process */
+	uint64_t seq;                   /* sequence number, odd during updates */
+	uint64_t date_ns;               /* CLOCK_MONOTONIC date of the update */
+	struct mt_list_stats stats[0];
+};
+
+/* registered lists, hashed by head address */
+struct _mt_list_st_slot {
+	const struct mt_list *lh;
+	char name[MT_LIST_STATS_NAME_LEN];
+	int64_t length_base;            /* sum of the length counters at reset */
+};
+
+/* counters of one list updated by one thread */
+struct _mt_list_st_ctr {
+	uint64_t ops[MT_LIST_TR_OPS];
+	uint64_t retries;
+	uint64_t backoff_ns;
+	int64_t length;
+};
+
+/* counters of one thread, indexed like _mt_list_st_lists */
+struct _mt_list_st_thr {
+	struct _mt_list_st_ctr ctr[MT_LIST_STATS_MAX];
+};
+
+MT_SHARED struct _mt_list_st_slot _mt_list_st_lists[MT_LIST_STATS_MAX];
+MT_SHARED unsigned int _mt_list_st_nblists;
+MT_SHARED struct mt_list_stats_shm *_mt_list_st_shm;
+MT_SHARED struct _mt_list_st_thr *_mt_list_st_thrs[MT_LIST_STATS_MAX_THREADS];
+MT_SHARED unsigned int _mt_list_st_nbthrs;
+
+MT_SHARED __thread struct _mt_list_st_thr *_mt_list_st_thr;  /* own counters */
+MT_SHARED __thread struct _mt_list_st_ctr *_mt_list_st_cur;  /* current op's list */
+MT_SHARED __thread const void *_mt_list_st_last;             /* last head looked up */
+MT_SHARED __thread struct _mt_list_st_ctr *_mt_list_st_last_ctr;
+MT_SHARED __thread unsigned int _mt_list_st_last_nb;         /* lists registered then */
+MT_SHARED __thread uint64_t _mt_list_st_t0;                  /* back-off start */
+
+/* adds <delta> to counter <v> which only the calling thread writes to */
+#define _MT_LIST_ST_ADD(v, delta) __atomic_store_n(&(v), (v) + (delta), __ATOMIC_RELAXED)
+
+static inline uint64_t _mt_list_st_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* returns the index of head <lh> if it is registered, otherwise -1 */
+static inline int _mt_list_st_lookup(const void *lh)
+{
+	unsigned int i, n;
+	const void *cur;
+
+	i = ((uintptr_t)lh >> 4) * 0x9E3779B1U;
+	for (n = 0; n < MT_LIST_STATS_MAX; n++, i++) {
+		cur = __atomic_load_n(&_mt_list_st_lists[i & (MT_LIST_STATS_MAX - 1)].lh, __ATOMIC_ACQUIRE);
+		if (cur == lh)
+			return i & (MT_LIST_STATS_MAX - 1);
+		if (!cur)
+			break;
+	}
+	return -1;
+}
+
+/* Allocates and registers the calling thread's counters. Returns NULL if the
+ * thread cannot account its operations, in which case it will not try again.
+ */
+static struct _mt_list_st_thr *_mt_list_st_alloc()
+{
+	struct _mt_list_st_thr *thr;
+	unsigned int slot;
+
+	thr = (struct _mt_list_st_thr *)calloc(1, sizeof(*thr));
+	if (!thr)
+		goto fail;
+
+	slot = __atomic_fetch_add(&_mt_list_st_nbthrs, 1, __ATOMIC_RELAXED);
+	if (slot >= MT_LIST_STATS_MAX_THREADS) {
+		free(thr);
+		goto fail;
+	}
+	__atomic_store_n(&_mt_list_st_thrs[slot], thr, __ATOMIC_RELEASE);
+	return _mt_list_st_thr = thr;
+ fail:
+	_mt_list_st_thr = (struct _mt_list_st_thr *)MT_LIST_BUSY;
+	return NULL;
+}
+
+/* Returns the calling thread's counters for head <lh>, or NULL if <lh> is not
+ * registered or the thread cannot account its operations. The result for the
+ * last head is reused until another list gets registered.
+ */
+static inline struct _mt_list_st_ctr *_mt_list_st_get(const void *lh)
+{
+	unsigned int nb = __atomic_load_n(&_mt_list_st_nblists, __ATOMIC_ACQUIRE);
+	struct _mt_list_st_thr *thr;
+	int idx;
+
+	if (!nb)
+		return NULL;
+	if (lh == _mt_list_st_last && nb == _mt_list_st_last_nb)
+		return _mt_list_st_last_ctr;
+
+	_mt_list_st_last = lh;
+	_mt_list_st_last_nb = nb;
+	_mt_list_st_last_ctr = NULL;
+
+	idx = _mt_list_st_lookup(lh);
+	if (idx < 0)
+		return NULL;
+	thr = _mt_list_st_thr;
+	if (!thr)
+		thr = _mt_list_st_alloc();
+	if (!thr || thr == (void *)MT_LIST_BUSY)
+		return NULL;
+	return _mt_list_st_last_ctr = &thr->ctr[idx];
+}
+
+/* returns the sum of the length counters of all threads for list <idx> */
+static inline int64_t _mt_list_st_length(unsigned int idx)
+{
+	const struct _mt_list_st_thr *thr;
+	unsigned int t, nb;
+	int64_t len = 0;
+
+	nb = __atomic_load_n(&_mt_list_st_nbthrs, __ATOMIC_ACQUIRE);
+	for (t = 0; t < nb && t < MT_LIST_STATS_MAX_THREADS; t++) {
+		thr = __atomic_load_n(&_mt_list_st_thrs[t], __ATOMIC_ACQUIRE);
+		if (thr)
+			len += __atomic_load_n(&thr->ctr[idx].length, __ATOMIC_RELAXED);
+	}
+	return len;
+}
+
+/* Resets the length estimate of the list the calling thread's counters <ctr>
+ * belong to. Since other threads' counters cannot be modified, their current
+ * sum becomes the new base of the estimate.
+ */
+static void _mt_list_st_len_reset(const struct _mt_list_st_ctr *ctr)
+{
+	unsigned int idx = ctr - _mt_list_st_thr->ctr;
+
+	__atomic_store_n(&_mt_list_st_lists[idx].length_base, _mt_list_st_length(idx), __ATOMIC_RELAXED);
+}
+
+/* Registers list head <lh> under name <name> (truncated to 31 characters).
+ * Returns 0 on success, or -1 if the table is full or the list already
+ * registered. Registrations must not be performed by several threads at once,
+ * but may happen while other threads use the lists. Example:
+ *
+ *   mt_list_stats_register(&run_queue, "run_queue");
+ */
+static inline int mt_list_stats_register(struct mt_list *lh, const char *name)
+{
+	struct _mt_list_st_slot *slot;
+	unsigned int i, n;
+
+	i = ((uintptr_t)lh >> 4) * 0x9E3779B1U;
+	for (n = 0; n < MT_LIST_STATS_MAX; n++, i++) {
+		slot = &_mt_list_st_lists[i & (MT_LIST_STATS_MAX - 1)];
+		if (slot->lh == lh)
+			return -1;
+		if (!slot->lh) {
+			strncpy(slot->name, name, MT_LIST_STATS_NAME_LEN - 1);
+			__atomic_store_n(&slot->lh, lh, __ATOMIC_RELEASE);
+			__atomic_fetch_add(&_mt_list_st_nblists, 1, __ATOMIC_RELEASE);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Copies the sum of all threads' counters of all registered lists into the
+ * shared memory segment created by mt_list_stats_export(), if any. It must not
+ * be called by several threads at once.
+ */
+static inline void mt_list_stats_publish()
+{
+	struct mt_list_stats_shm *shm = _mt_list_st_shm;
+	struct mt_list_stats *dst;
+	const struct _mt_list_st_thr *thr;
+	const struct _mt_list_st_ctr *src;
+	unsigned int i, n, t, nbthrs, op;
+
+	if (!shm)
+		return;
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	nbthrs = __atomic_load_n(&_mt_list_st_nbthrs, __ATOMIC_ACQUIRE);
+	if (nbthrs > MT_LIST_STATS_MAX_THREADS)
+		nbthrs = MT_LIST_STATS_MAX_THREADS;
+
+	for (i = n = 0; i < MT_LIST_STATS_MAX; i++) {
+		if (!__atomic_load_n(&_mt_list_st_lists[i].lh, __ATOMIC_ACQUIRE))
+			continue;
+		dst = &shm->stats[n++];
+		memset(dst, 0, sizeof(*dst));
+		memcpy(dst->name, _mt_list_st_lists[i].name, sizeof(dst->name));
+		dst->length = -__atomic_load_n(&_mt_list_st_lists[i].length_base, __ATOMIC_RELAXED);
+		for (t = 0; t < nbthrs; t++) {
+			thr = __atomic_load_n(&_mt_list_st_thrs[t], __ATOMIC_ACQUIRE);
+			if (!thr)
+				continue;
+			src = &thr->ctr[i];
+			for (op = 0; op < MT_LIST_TR_OPS; op++)
+				dst->ops[op] += __atomic_load_n(&src->ops[op], __ATOMIC_RELAXED);
+			dst->retries    += __atomic_load_n(&src->retries, __ATOMIC_RELAXED);
+			dst->backoff_ns += __atomic_load_n(&src->backoff_ns, __ATOMIC_RELAXED);
+			dst->length     += __atomic_load_n(&src->length, __ATOMIC_RELAXED);
+		}
+	}
+	shm->lists = n;
+	shm->date_ns = _mt_list_st_now();
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+}
+
+/* Creates the POSIX shared memory segment <name> (e.g. "/myapp.lists") and
+ * publishes the counters there a first time. Returns 0 on success, or -1 on
+ * error with errno set. The segment should be removed with shm_unlink() when
+ * the process stops.
+ */
+static inline int mt_list_stats_export(const char *name)
+{
+	size_t size = sizeof(struct mt_list_stats_shm) + MT_LIST_STATS_MAX * sizeof(struct mt_list_stats);
+	void *area;
+	int fd;
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return -1;
+	}
+	area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (area == MAP_FAILED)
+		return -1;
+
+	_mt_list_st_shm = (struct mt_list_stats_shm *)area;
+	memcpy(_mt_list_st_shm->magic, "MTLSTATS", 8);
+	_mt_list_st_shm->version = 1;
+	_mt_list_st_shm->ops     = MT_LIST_TR_OPS;
+	_mt_list_st_shm->pid     = getpid();
+	mt_list_stats_publish();
+	return 0;
+}
+
+/* Starts accounting operation <op> on head <lh>. It must be placed after the
+ * function's declarations.
+ */
+#define MT_LIST_STATS_OP(op, lh)					\
+	do {								\
+		_mt_list_st_cur = _mt_list_st_get(lh);			\
+		if (_mt_list_st_cur)					\
+			_MT_LIST_ST_ADD(_mt_list_st_cur->ops[op], 1);	\
+	} while (0)
+
+/* Adds <delta> to the length estimate of the current operation's list */
+#define MT_LIST_STATS_LEN(delta)					\
+	do {								\
+		if (_mt_list_st_cur)					\
+			_MT_LIST_ST_ADD(_mt_list_st_cur->length, (delta)); \
+	} while (0)
+
+/* Resets the length estimate of the current operation's list */
+#define MT_LIST_STATS_LEN_RESET()					\
+	do {								\
+		if (_mt_list_st_cur)					\
+			_mt_list_st_len_reset(_mt_list_st_cur);		\
+	} while (0)
+
+/* Surround the back-off of the current operation */
+#define MT_LIST_STATS_BACKOFF_BEGIN()					\
+	do {								\
+		if (_mt_list_st_cur)					\
+			_mt_list_st_t0 = _mt_list_st_now();		\
+	} while (0)
+
+#define MT_LIST_STATS_BACKOFF_END()					\
+	do {								\
+		if (_mt_list_st_cur) {					\
+			_MT_LIST_ST_ADD(_mt_list_st_cur->retries, 1);	\
+			_MT_LIST_ST_ADD(_mt_list_st_cur->backoff_ns, _mt_list_st_now() - _mt_list_st_t0); \
+		}							\
+	} while (0)
+
+#else /* !MT_LIST_STATS */
+
+#define MT_LIST_STATS_OP(op, lh)      do { } while (0)
+#define MT_LIST_STATS_LEN(delta)      do { } while (0)
+#define MT_LIST_STATS_LEN_RESET()     do { } while (0)
+#define MT_LIST_STATS_BACKOFF_BEGIN() do { } while (0)
+#define MT_LIST_STATS_BACKOFF_END()   do { } while (0)
+
+#endif /* MT_LIST_STATS */
+
+
+/* Marks the beginning of operation <op> on element or head <el> for the
+ * tracing, watchdog and statistics features above. It must be placed after
+ * the function's declarations.
+ */
+#define MT_LIST_OP_BEGIN(op, el)					\
+	MT_LIST_TRACE_OP(op, el);					\
+	MT_LIST_WATCH_OP(op, el);					\
+	MT_LIST_STATS_OP(op, el)
 
 
 /* This is a Xorshift-based thread-local PRNG aimed at reducing the risk of
@@ -271,6 +1377,10 @@ static inline __attribute__((always_inline)) unsigned long mt_list_cpu_relax1()
  */
 static inline __attribute__((always_inline)) unsigned long mt_list_cpu_relax(unsigned long loop)
 {
+	MT_LIST_TRACE_RETRY();
+	MT_LIST_WATCH_RETRY();
+	MT_LIST_STATS_BACKOFF_BEGIN();
+
 	/* limit maximum wait time for unlucky threads */
 	loop = mt_list_wait(loop);
 
@@ -280,6 +1390,7 @@ static inline __attribute__((always_inline)) unsigned long mt_list_cpu_relax(uns
 	/* faster ending */
 	while (loop--)
 		asm volatile("");
+	MT_LIST_STATS_BACKOFF_END();
 	return 1;
 }
 
@@ -325,6 +1436,7 @@ static MT_INLINE long mt_list_try_insert(struct mt_list *lh, struct mt_list *el)
 	struct mt_list *p, *p2;
 	unsigned long loops = 0;
         long ret = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_TRY_INSERT, lh);
 
 	/* Note that the first element checked is the most likely to face
 	 * contention, particularly on the list's head/tail. That's why we
@@ -378,6 +1490,9 @@ static MT_INLINE long mt_list_try_insert(struct mt_list *lh, struct mt_list *el)
 			break;
 		}
 
+		MT_LIST_DELAY_POINT(MT_LIST_TR_TRY_INSERT);
+		MT_LIST_STATS_LEN(1);
+
 		el->next = n;
 		el->prev = p;
 		__atomic_thread_fence(__ATOMIC_RELEASE);
@@ -407,6 +1522,7 @@ static MT_INLINE long mt_list_try_append(struct mt_list *lh, struct mt_list *el)
 	struct mt_list *p, *p2;
 	unsigned long loops = 0;
 	long ret = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_TRY_APPEND, lh);
 
 	/* Note that the first element checked is the most likely to face
 	 * contention, particularly on the list's head/tail. That's why we
@@ -460,6 +1576,9 @@ static MT_INLINE long mt_list_try_append(struct mt_list *lh, struct mt_list *el)
 			break;
 		}
 
+		MT_LIST_DELAY_POINT(MT_LIST_TR_TRY_APPEND);
+		MT_LIST_STATS_LEN(1);
+
 		el->next = n;
 		el->prev = p;
 		__atomic_thread_fence(__ATOMIC_RELEASE);
@@ -489,6 +1608,7 @@ static MT_INLINE struct mt_list *mt_list_behead(struct mt_list *lh)
 	struct mt_list *n;
 	struct mt_list *p;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_BEHEAD, lh);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		p = __atomic_exchange_n(&lh->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -515,6 +1635,9 @@ static MT_INLINE struct mt_list *mt_list_behead(struct mt_list *lh)
 			break;
 		}
 
+		MT_LIST_DELAY_POINT(MT_LIST_TR_BEHEAD);
+		MT_LIST_STATS_LEN_RESET();
+
 		lh->next = lh->prev = lh;
 		__atomic_thread_fence(__ATOMIC_RELEASE);
 
@@ -540,6 +1663,7 @@ static MT_INLINE void mt_list_insert(struct mt_list *lh, struct mt_list *el)
 	struct mt_list *n;
 	struct mt_list *p;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_INSERT, lh);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		n = __atomic_exchange_n(&lh->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -553,6 +1677,9 @@ static MT_INLINE void mt_list_insert(struct mt_list *lh, struct mt_list *el)
 			continue;
 		}
 
+		MT_LIST_DELAY_POINT(MT_LIST_TR_INSERT);
+		MT_LIST_STATS_LEN(1);
+
 		el->next = n;
 		el->prev = p;
 		__atomic_thread_fence(__ATOMIC_RELEASE);
@@ -578,6 +1705,7 @@ static MT_INLINE void mt_list_append(struct mt_list *lh, struct mt_list *el)
 	struct mt_list *n;
 	struct mt_list *p;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_APPEND, lh);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		p = __atomic_exchange_n(&lh->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -591,6 +1719,9 @@ static MT_INLINE void mt_list_append(struct mt_list *lh, struct mt_list *el)
 			continue;
 		}
 
+		MT_LIST_DELAY_POINT(MT_LIST_TR_APPEND);
+		MT_LIST_STATS_LEN(1);
+
 		el->next = n;
 		el->prev = p;
 		__atomic_thread_fence(__ATOMIC_RELEASE);
@@ -620,6 +1751,7 @@ static MT_INLINE long mt_list_delete(struct mt_list *el)
 	struct mt_list *p, *p2;
 	unsigned long loops = 0;
 	long ret = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_DELETE, el);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		p2 = NULL;
@@ -656,6 +1788,8 @@ static MT_INLINE long mt_list_delete(struct mt_list *el)
 			}
 		}
 
+		MT_LIST_DELAY_POINT(MT_LIST_TR_DELETE);
+
 		n->prev = p;
 		p->next = n;
 		__atomic_thread_fence(__ATOMIC_RELEASE);
@@ -679,6 +1813,7 @@ static MT_INLINE struct mt_list *mt_list_pop(struct mt_list *lh)
 	struct mt_list *n, *n2;
 	struct mt_list *p, *p2;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_POP, lh);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		n = __atomic_exchange_n(&lh->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -721,6 +1856,9 @@ static MT_INLINE struct mt_list *mt_list_pop(struct mt_list *lh)
 			continue;
 		}
 
+		MT_LIST_DELAY_POINT(MT_LIST_TR_POP);
+		MT_LIST_STATS_LEN(-1);
+
 		lh->next = n2;
 		n2->prev = lh;
 		__atomic_thread_fence(__ATOMIC_RELEASE);
@@ -735,6 +1873,309 @@ static MT_INLINE struct mt_list *mt_list_pop(struct mt_list *lh)
 }
 
 
+/* Removes the first element from the list <lh> only if predicate <pred>
+ * accepts it, and returns it in detached form. If the list is empty or if the
+ * predicate rejects the first element, NULL is returned instead and the list
+ * is left untouched. The predicate is called with the element and <ctx>, and
+ * must return non-zero to accept it. It is called while the element and the
+ * link from the head are locked, so it must be short and must not perform any
+ * operation on the list. It may be called more than once for the same element
+ * in case of contention, so it must not have side effects. The emptiness check
+ * is first performed with a simple load so that polling an empty list doesn't
+ * steal the head's cache line from producers, and the link to the next element
+ * is only locked once the element was accepted. This is typically used to pop
+ * expired entries from timer or deadline queues.
+ */
+static MT_INLINE struct mt_list *mt_list_pop_if(struct mt_list *lh, long (*pred)(struct mt_list *el, void *ctx), void *ctx)
+{
+	struct mt_list *n, *n2;
+	struct mt_list *p, *p2;
+	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_POP_IF, lh);
+
+	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
+		if (__atomic_load_n(&lh->next, __ATOMIC_RELAXED) == lh) {
+			/* list is empty, no need to lock anything */
+			n = NULL;
+			break;
+		}
+
+		n = __atomic_exchange_n(&lh->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (n == MT_LIST_BUSY)
+			continue;
+
+		if (n == lh) {
+			/* list is empty */
+			lh->next = lh;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			n = NULL;
+			break;
+		}
+
+		p = __atomic_exchange_n(&n->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (p == MT_LIST_BUSY) {
+			lh->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		n2 = __atomic_exchange_n(&n->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (n2 == MT_LIST_BUSY) {
+			n->prev = p;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			lh->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		/* the element is now locked and stable, let's check it */
+		if (!pred(n, ctx)) {
+			n->next = n2;
+			n->prev = p;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			lh->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			n = NULL;
+			break;
+		}
+
+		p2 = __atomic_exchange_n(&n2->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (p2 == MT_LIST_BUSY) {
+			n->next = n2;
+			n->prev = p;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			lh->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		MT_LIST_DELAY_POINT(MT_LIST_TR_POP_IF);
+		MT_LIST_STATS_LEN(-1);
+
+		lh->next = n2;
+		n2->prev = lh;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		n->prev = n->next = n;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		/* return n */
+		break;
+	}
+	return n;
+}
+
+
+/* Detaches all elements located after element <el> in the list whose head is
+ * <lh>, and moves them to the list head <to>, which must be empty and not
+ * visible to other threads (e.g. a local variable). If <el> is the list's
+ * head, all elements are moved. Only the link following <el> and the link
+ * preceding <lh> are locked, so that the cost doesn't depend on the number of
+ * elements that are moved. Elements located between these two links may
+ * still be concurrently deleted. Returns non-zero if at least one element was
+ * moved, otherwise zero if there was no element after <el>, in which case
+ * <to> is left untouched. <el> must be part of the list headed by <lh>. This
+ * is not safe against threads walking over the list (iterators,
+ * mt_list_foreach(), mt_list_snapshot() etc.): one which is visiting the
+ * moved elements would continue its walk in <to> and never find its own head
+ * again. Making it safe would require locking every moved element, which is
+ * what this function avoids. Thus when it is used to rebalance elements
+ * between shared lists (e.g. per-thread shards), the caller must make sure by
+ * other means that nobody walks over the source list meanwhile, and users of
+ * the lists must not assume that an element remains in the list it was added
+ * to. Example:
+ *
+ *   struct mt_list tail = MT_LIST_HEAD_INIT(tail);
+ *   if (mt_list_cut(&shard->queue, &last_kept->list, &tail))
+ *       mt_list_merge(&other_shard->queue, &tail);
+ */
+static MT_INLINE long mt_list_cut(struct mt_list *lh, struct mt_list *el, struct mt_list *to)
+{
+	struct mt_list *n, *n2;
+	struct mt_list *p, *p2;
+	unsigned long loops = 0;
+	long ret = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_CUT, el);
+
+	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
+		n = __atomic_exchange_n(&el->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (n == MT_LIST_BUSY)
+			continue;
+
+		if (n == lh) {
+			/* nothing after <el> */
+			el->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			break;
+		}
+
+		n2 = __atomic_exchange_n(&n->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (n2 == MT_LIST_BUSY) {
+			el->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		p = __atomic_exchange_n(&lh->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (p == MT_LIST_BUSY) {
+			n->prev = n2;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			el->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		p2 = __atomic_exchange_n(&p->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (p2 == MT_LIST_BUSY) {
+			lh->prev = p;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			n->prev = n2;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			el->next = n;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		MT_LIST_DELAY_POINT(MT_LIST_TR_CUT);
+
+		/* the segment is n..p, move it to <to> */
+		to->next = n;
+		to->prev = p;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		n->prev = to;
+		p->next = to;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		lh->prev = el;
+		el->next = lh;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		ret = 1;
+		break;
+	}
+	return ret;
+}
+
+
+/* Moves all elements of list <src> to the end of list <dst>, in the same
+ * order, leaving <src> empty. Both lists may be shared. Only the links around
+ * <src> and the link preceding <dst> are locked, so that the cost doesn't
+ * depend on the number of elements that are moved. Returns non-zero if at
+ * least one element was moved, otherwise zero if <src> was empty. <src> and
+ * <dst> must be different lists. Just like with mt_list_cut(), nobody may
+ * walk over <src> meanwhile. Threads walking over <dst> are not affected, they
+ * will simply visit the added elements.
+ */
+static MT_INLINE long mt_list_merge(struct mt_list *dst, struct mt_list *src)
+{
+	struct mt_list *f, *f2;
+	struct mt_list *l, *l2;
+	struct mt_list *p, *p2;
+	unsigned long loops = 0;
+	long ret = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_MERGE, dst);
+
+	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
+		f = __atomic_exchange_n(&src->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (f == MT_LIST_BUSY)
+			continue;
+
+		if (f == src) {
+			/* nothing to move */
+			src->next = f;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			break;
+		}
+
+		f2 = __atomic_exchange_n(&f->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (f2 == MT_LIST_BUSY) {
+			src->next = f;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		l = __atomic_exchange_n(&src->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (l == MT_LIST_BUSY) {
+			f->prev = f2;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			src->next = f;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		l2 = __atomic_exchange_n(&l->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (l2 == MT_LIST_BUSY) {
+			src->prev = l;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			f->prev = f2;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			src->next = f;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		p = __atomic_exchange_n(&dst->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (p == MT_LIST_BUSY) {
+			l->next = l2;
+			src->prev = l;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			f->prev = f2;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			src->next = f;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		p2 = __atomic_exchange_n(&p->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (p2 == MT_LIST_BUSY) {
+			dst->prev = p;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			l->next = l2;
+			src->prev = l;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			f->prev = f2;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			src->next = f;
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			continue;
+		}
+
+		MT_LIST_DELAY_POINT(MT_LIST_TR_MERGE);
+
+		/* the segment f..l goes between p and dst */
+		f->prev = p;
+		l->next = dst;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		dst->prev = l;
+		p->next = f;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		src->next = src->prev = src;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		ret = 1;
+		break;
+	}
+	return ret;
+}
+
+
 /* Opens the list just after <lh> which usually is the list's head, but not
  * necessarily. The link between <lh> and its next element is cut and replaced
  * with an MT_LIST_BUSY lock. The ends of the removed link are returned as an
@@ -759,6 +2200,7 @@ static MT_INLINE struct mt_list mt_list_lock_next(struct mt_list *lh)
 {
 	struct mt_list el;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_LOCK_NEXT, lh);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		el.next = __atomic_exchange_n(&lh->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -773,6 +2215,9 @@ static MT_INLINE struct mt_list mt_list_lock_next(struct mt_list *lh)
 		}
 		break;
 	}
+	MT_LIST_HOLD_BEGIN(el.prev);
+	MT_LIST_WATCH_LOCKED(lh);
+	MT_LIST_DELAY_POINT(MT_LIST_TR_LOCK_NEXT);
 	return el;
 }
 
@@ -801,6 +2246,7 @@ static MT_INLINE struct mt_list mt_list_lock_prev(struct mt_list *lh)
 {
 	struct mt_list el;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_LOCK_PREV, lh);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		el.prev = __atomic_exchange_n(&lh->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -815,6 +2261,9 @@ static MT_INLINE struct mt_list mt_list_lock_prev(struct mt_list *lh)
 		}
 		break;
 	}
+	MT_LIST_HOLD_BEGIN(el.prev);
+	MT_LIST_WATCH_LOCKED(lh);
+	MT_LIST_DELAY_POINT(MT_LIST_TR_LOCK_PREV);
 	return el;
 }
 
@@ -827,6 +2276,7 @@ static MT_INLINE struct mt_list mt_list_lock_elem(struct mt_list *el)
 {
 	unsigned long loops = 0;
 	struct mt_list ret;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_LOCK_ELEM, el);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		ret.next = __atomic_exchange_n(&el->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -841,6 +2291,9 @@ static MT_INLINE struct mt_list mt_list_lock_elem(struct mt_list *el)
 		}
 		break;
 	}
+	MT_LIST_HOLD_BEGIN(ret.prev);
+	MT_LIST_WATCH_LOCKED(el);
+	MT_LIST_DELAY_POINT(MT_LIST_TR_LOCK_ELEM);
 	return ret;
 }
 
@@ -850,6 +2303,7 @@ static MT_INLINE struct mt_list mt_list_lock_elem(struct mt_list *el)
  */
 static inline void mt_list_unlock_elem(struct mt_list *el, struct mt_list back)
 {
+	MT_LIST_HOLD_END(back.prev);
 	*el = back;
 	__atomic_thread_fence(__ATOMIC_RELEASE);
 }
@@ -897,6 +2351,7 @@ static MT_INLINE struct mt_list mt_list_lock_full(struct mt_list *el)
 	struct mt_list *p2;
 	struct mt_list ret;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_LOCK_FULL, el);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		p2 = NULL;
@@ -932,6 +2387,9 @@ static MT_INLINE struct mt_list mt_list_lock_full(struct mt_list *el)
 		}
 		break;
 	}
+	MT_LIST_HOLD_BEGIN(ret.prev);
+	MT_LIST_WATCH_LOCKED(el);
+	MT_LIST_DELAY_POINT(MT_LIST_TR_LOCK_FULL);
 	return ret;
 }
 
@@ -947,6 +2405,7 @@ static MT_INLINE struct mt_list mt_list_lock_full(struct mt_list *el)
  */
 static inline void mt_list_unlock_link(struct mt_list ends)
 {
+	MT_LIST_HOLD_END(ends.prev);
 	/* make sure any previous writes to <ends> are seen */
 	__atomic_thread_fence(__ATOMIC_RELEASE);
 	ends.next->prev = ends.prev;
@@ -967,6 +2426,7 @@ static inline void mt_list_unlock_link(struct mt_list ends)
  */
 static inline void mt_list_unlock_full(struct mt_list *el, struct mt_list ends)
 {
+	MT_LIST_HOLD_END(ends.prev);
 	*el = ends;
 	__atomic_thread_fence(__ATOMIC_RELEASE);
 
@@ -977,6 +2437,640 @@ static inline void mt_list_unlock_full(struct mt_list *el, struct mt_list ends)
 }
 
 
+/* With MT_LIST_HOLD, the lock functions are called through macros designating
+ * the call site for the hold-time statistics.
+ */
+#if defined(MT_LIST_HOLD)
+#define mt_list_lock_next(lh) (_mt_list_hold_site = MT_LIST_HOLD_SITE(), mt_list_lock_next(lh))
+#define mt_list_lock_prev(lh) (_mt_list_hold_site = MT_LIST_HOLD_SITE(), mt_list_lock_prev(lh))
+#define mt_list_lock_elem(el) (_mt_list_hold_site = MT_LIST_HOLD_SITE(), mt_list_lock_elem(el))
+#define mt_list_lock_full(el) (_mt_list_hold_site = MT_LIST_HOLD_SITE(), mt_list_lock_full(el))
+#endif
+
+
+/* Maximum number of operations that may be passed at once to mt_list_apply().
+ * Each operation needs up to 4 pointers to be locked.
+ */
+#ifndef MT_LIST_MAX_OPS
+#define MT_LIST_MAX_OPS 8
+#endif
+
+/* Operation types for struct mt_list_op */
+#define MT_LIST_OP_DELETE  1   /* remove <el> from its list */
+#define MT_LIST_OP_INSERT  2   /* add <el> after <pos> */
+#define MT_LIST_OP_APPEND  3   /* add <el> before <pos> */
+
+/* One operation to be performed by mt_list_apply(). <pos> is ignored for
+ * deletions.
+ */
+struct mt_list_op {
+	int type;                  /* MT_LIST_OP_* */
+	struct mt_list *el;        /* element to delete, insert or append */
+	struct mt_list *pos;       /* element to insert after or append before */
+};
+
+/* Pointer locked by mt_list_apply(), with the value it had before locking
+ * (restored on rollback) and the value it will receive when unlocking.
+ */
+struct _mt_list_slot {
+	struct mt_list **addr;
+	struct mt_list *old;
+	struct mt_list *val;
+};
+
+/* Set of pointers locked by mt_list_apply() */
+struct _mt_list_lockset {
+	unsigned int nb;
+	struct _mt_list_slot slot[4 * MT_LIST_MAX_OPS];
+};
+
+
+/* Looks up pointer <addr> in lockset <ls>. If it was already locked by this
+ * lockset, its slot is returned. Otherwise, if <lock> is non-zero the pointer
+ * is locked and a new slot is returned, or NULL if it was already locked by
+ * another thread. If <lock> is zero, the pointer is only recorded without
+ * being locked (used for elements the caller owns).
+ */
+static inline struct _mt_list_slot *_mt_list_ls_get(struct _mt_list_lockset *ls, struct mt_list **addr, int lock)
+{
+	struct _mt_list_slot *s;
+	struct mt_list *v;
+	unsigned int i;
+
+	for (i = 0; i < ls->nb; i++)
+		if (ls->slot[i].addr == addr)
+			return &ls->slot[i];
+
+	if (lock) {
+		v = __atomic_exchange_n(addr, MT_LIST_BUSY, __ATOMIC_RELAXED);
+		if (v == MT_LIST_BUSY)
+			return NULL;
+	} else
+		v = *addr;
+
+	s = &ls->slot[ls->nb++];
+	s->addr = addr;
+	s->old = s->val = v;
+	return s;
+}
+
+
+/* Restores all pointers of lockset <ls> to their original values in reverse
+ * locking order, and empties the lockset.
+ */
+static inline void _mt_list_ls_rollback(struct _mt_list_lockset *ls)
+{
+	while (ls->nb) {
+		ls->nb--;
+		*ls->slot[ls->nb].addr = ls->slot[ls->nb].old;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+}
+
+
+/* Assigns all pointers of lockset <ls> their new values, which unlocks them,
+ * and empties the lockset.
+ */
+static inline void _mt_list_ls_commit(struct _mt_list_lockset *ls)
+{
+	unsigned int i;
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < ls->nb; i++) {
+		*ls->slot[i].addr = ls->slot[i].val;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+	ls->nb = 0;
+}
+
+
+/* Atomically applies the <nbops> operations described in array <ops>, which
+ * may involve different lists, so that no other thread may ever observe an
+ * intermediary state. Operations are applied in array order, so that moving
+ * an element from one list to another simply consists in deleting it then
+ * appending it. First, the elements to be deleted and the positions to insert
+ * at are all locked in ascending address order, then the links around them
+ * are locked, and the final state is computed before everything is unlocked
+ * at once. If any pointer cannot be locked, all the ones held are released in
+ * reverse order and the whole sequence is retried after a back-off, so that
+ * concurrent calls on overlapping sets of elements cannot deadlock. Returns
+ * non-zero on success. If an element to be deleted is not part of a list
+ * (e.g. it was concurrently removed), nothing is changed and zero is
+ * returned. At most MT_LIST_MAX_OPS operations may be passed. Elements to be
+ * inserted or appended must either be deleted by a previous operation or not
+ * be part of any list, and positions must not be elements deleted by a
+ * previous operation. Example:
+ *
+ *   struct mt_list_op ops[2] = {
+ *       { .type = MT_LIST_OP_DELETE, .el = &task->list },
+ *       { .type = MT_LIST_OP_APPEND, .el = &task->list, .pos = &run_queue },
+ *   };
+ *   if (!mt_list_apply(ops, 2))
+ *       return; // task was not queued anymore
+ */
+static MT_INLINE long mt_list_apply(const struct mt_list_op *ops, unsigned int nbops)
+{
+	struct _mt_list_lockset ls;
+	struct _mt_list_slot *sn, *sp, *s1, *s2;
+	struct mt_list **order[2 * MT_LIST_MAX_OPS];
+	struct mt_list **addr;
+	struct mt_list *n, *p, *el;
+	unsigned int nbo, i, j;
+	unsigned long loops = 0;
+	int notinlist = 0;
+	long ret = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_APPLY, nbops ? ops[0].el : NULL);
+
+	if (nbops > MT_LIST_MAX_OPS)
+		return 0;
+
+	/* sort the primary pointers to lock by ascending address */
+	for (nbo = i = 0; i < nbops; i++) {
+		if (ops[i].type == MT_LIST_OP_DELETE) {
+			order[nbo++] = &ops[i].el->next;
+			order[nbo++] = &ops[i].el->prev;
+		}
+		else if (ops[i].type == MT_LIST_OP_INSERT)
+			order[nbo++] = &ops[i].pos->next;
+		else
+			order[nbo++] = &ops[i].pos->prev;
+	}
+
+	for (i = 1; i < nbo; i++) {
+		addr = order[i];
+		for (j = i; j > 0 && (uintptr_t)order[j - 1] > (uintptr_t)addr; j--)
+			order[j] = order[j - 1];
+		order[j] = addr;
+	}
+
+	ls.nb = 0;
+	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
+		for (i = 0; i < nbo; i++)
+			if (!_mt_list_ls_get(&ls, order[i], 1))
+				break;
+		if (i < nbo) {
+			_mt_list_ls_rollback(&ls);
+			continue;
+		}
+
+		/* now compute the final state, locking the surrounding links */
+		for (i = 0; i < nbops; i++) {
+			el = ops[i].el;
+			if (ops[i].type == MT_LIST_OP_DELETE) {
+				sn = _mt_list_ls_get(&ls, &el->next, 1);
+				sp = _mt_list_ls_get(&ls, &el->prev, 1);
+				n = sn->val;
+				p = sp->val;
+				if (n == el || p == el) {
+					notinlist = 1;
+					break;
+				}
+
+				s1 = _mt_list_ls_get(&ls, &p->next, 1);
+				if (!s1)
+					break;
+				s2 = _mt_list_ls_get(&ls, &n->prev, 1);
+				if (!s2)
+					break;
+				s1->val = n;
+				s2->val = p;
+				sn->val = sp->val = el;
+			}
+			else {
+				sn = _mt_list_ls_get(&ls, &el->next, 0);
+				sp = _mt_list_ls_get(&ls, &el->prev, 0);
+				if (ops[i].type == MT_LIST_OP_INSERT) {
+					p = ops[i].pos;
+					s1 = _mt_list_ls_get(&ls, &p->next, 1);
+					n = s1->val;
+					s2 = _mt_list_ls_get(&ls, &n->prev, 1);
+					if (!s2)
+						break;
+				}
+				else {
+					n = ops[i].pos;
+					s2 = _mt_list_ls_get(&ls, &n->prev, 1);
+					p = s2->val;
+					s1 = _mt_list_ls_get(&ls, &p->next, 1);
+					if (!s1)
+						break;
+				}
+				sn->val = n;
+				sp->val = p;
+				s1->val = el;
+				s2->val = el;
+			}
+		}
+
+		if (i < nbops) {
+			/* conflict or element not in a list anymore */
+			_mt_list_ls_rollback(&ls);
+			if (notinlist)
+				break;
+			continue;
+		}
+
+		MT_LIST_DELAY_POINT(MT_LIST_TR_APPLY);
+		_mt_list_ls_commit(&ls);
+		ret = 1;
+		break;
+	}
+	return ret;
+}
+
+
+/* Atomically moves element <el> from the list it belongs to, to the end of
+ * list <lh>, which means that element <el> is added immediately before <lh>.
+ * No other thread may observe the element outside of any list. Returns
+ * non-zero on success, or zero if the element was not part of a list, in
+ * which case nothing is done.
+ */
+static inline long mt_list_move(struct mt_list *el, struct mt_list *lh)
+{
+	struct mt_list_op ops[2] = {
+		{ .type = MT_LIST_OP_DELETE, .el = el, .pos = NULL },
+		{ .type = MT_LIST_OP_APPEND, .el = el, .pos = lh },
+	};
+
+	return mt_list_apply(ops, 2);
+}
+
+
+/*****************************************************************************
+ * The functions and macros below operate on lists that are owned by the     *
+ * calling thread (e.g. a list extracted by mt_list_cut() or built locally), *
+ * hence they do not use any atomic operation. They must never be used on a  *
+ * list that may be accessed by another thread.                              *
+ *****************************************************************************/
+
+
+/* Iterates <item> through owned list <lh> of items of type "typeof(*item)"
+ * which are linked via a "struct mt_list" member named <member>. The current
+ * item must not be removed from the list, use MT_LIST_OWN_FOR_EACH_ENTRY_SAFE()
+ * for this. It is safe to break, goto or return from the loop. Example:
+ *
+ *   MT_LIST_OWN_FOR_EACH_ENTRY(item, &local, list)
+ *       process(item);
+ */
+#define MT_LIST_OWN_FOR_EACH_ENTRY(item, lh, member)				\
+	for (item = MT_LIST_ELEM((lh)->next, typeof(item), member);		\
+	     &item->member != (lh);						\
+	     item = MT_LIST_ELEM(item->member.next, typeof(item), member))
+
+/* Same as above except that the current item may be removed or moved to
+ * another list, as the next one is retrieved before visiting it. <back> is
+ * a temporary variable of the same type as <item>.
+ */
+#define MT_LIST_OWN_FOR_EACH_ENTRY_SAFE(item, back, lh, member)		\
+	for (item = MT_LIST_ELEM((lh)->next, typeof(item), member),		\
+	     back = MT_LIST_ELEM(item->member.next, typeof(item), member);	\
+	     &item->member != (lh);						\
+	     item = back,							\
+	     back = MT_LIST_ELEM(back->member.next, typeof(item), member))
+
+/* Returns a pointer of type <t> to the structure containing a member of type
+ * mt_list called <m> that comes from the first element in owned list <l>,
+ * that is detached. If the list is empty, NULL is returned instead.
+ */
+#define MT_LIST_OWN_POP(lh, t, m)					\
+	({								\
+		struct mt_list *_n = mt_list_own_pop(lh);		\
+		(_n ? MT_LIST_ELEM(_n, t, m) : NULL);			\
+	})
+
+
+/* Adds element <el> after element <lh> of an owned list, hence at the
+ * beginning of the list if <lh> is its head.
+ */
+static inline void mt_list_own_insert(struct mt_list *lh, struct mt_list *el)
+{
+	el->next = lh->next;
+	el->prev = lh;
+	lh->next->prev = el;
+	lh->next = el;
+}
+
+
+/* Adds element <el> before element <lh> of an owned list, hence at the end of
+ * the list if <lh> is its head.
+ */
+static inline void mt_list_own_append(struct mt_list *lh, struct mt_list *el)
+{
+	el->next = lh;
+	el->prev = lh->prev;
+	lh->prev->next = el;
+	lh->prev = el;
+}
+
+
+/* Removes element <el> from the owned list it belongs to, and reinitializes
+ * it. Returns non-zero if the element was part of a list, otherwise zero.
+ */
+static inline long mt_list_own_delete(struct mt_list *el)
+{
+	long ret = el->next != el;
+
+	el->prev->next = el->next;
+	el->next->prev = el->prev;
+	el->next = el->prev = el;
+	return ret;
+}
+
+
+/* Removes the first element from owned list <lh>, and returns it in detached
+ * form. If the list is empty, NULL is returned instead.
+ */
+static inline struct mt_list *mt_list_own_pop(struct mt_list *lh)
+{
+	struct mt_list *n = lh->next;
+
+	if (n == lh)
+		return NULL;
+	mt_list_own_delete(n);
+	return n;
+}
+
+
+/* Turns the chain of elements starting at <first> returned by mt_list_behead()
+ * into an owned list headed by <lh>, so that it can be manipulated using the
+ * functions above. If <first> is NULL, <lh> is turned into an empty list. The
+ * list head is returned.
+ */
+static inline struct mt_list *mt_list_own_attach(struct mt_list *lh, struct mt_list *first)
+{
+	if (!first)
+		return mt_list_init(lh);
+
+	lh->next = first;
+	lh->prev = first->prev;
+	lh->prev->next = lh;
+	first->prev = lh;
+	return lh;
+}
+
+
+/* Publishes all elements of owned list <src> at the end of shared list <dst>,
+ * in the same order, and leaves <src> empty. Only the link preceding <dst> is
+ * locked, and only once, regardless of the number of elements. Returns non-
+ * zero if at least one element was moved, otherwise zero if <src> was empty.
+ */
+static inline long mt_list_own_publish(struct mt_list *dst, struct mt_list *src)
+{
+	struct mt_list ends;
+	struct mt_list *f, *l;
+
+	if (src->next == src)
+		return 0;
+
+	f = src->next;
+	l = src->prev;
+	ends = mt_list_lock_prev(dst);
+
+	/* the link is rewritten by hand and not through an unlock function */
+	MT_LIST_HOLD_END(ends.prev);
+	f->prev = ends.prev;
+	l->next = ends.next;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	/* <dst> is unlocked last, otherwise mt_list_behead() could take the
+	 * list while the previous last element's next pointer is still locked.
+	 */
+	ends.prev->next = f;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	ends.next->prev = l;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	mt_list_init(src);
+	return 1;
+}
+
+
+/* Maximum number of threads mt_list_sort() may use */
+#ifndef MT_LIST_SORT_MAX_THREADS
+#define MT_LIST_SORT_MAX_THREADS 64
+#endif
+
+/* Merges the two sorted NULL-terminated chains of elements linked by their
+ * next pointer <a> and <b> according to <cmp>, and returns the resulting
+ * chain. Elements from <a> come first on equality so that the sort is stable.
+ */
+static inline struct mt_list *_mt_list_sort_merge(struct mt_list *a, struct mt_list *b,
+                                                  int (*cmp)(const struct mt_list *, const struct mt_list *))
+{
+	struct mt_list head;
+	struct mt_list *tail = &head;
+
+	while (a && b) {
+		if (cmp(a, b) <= 0) {
+			tail->next = a;
+			a = a->next;
+		} else {
+			tail->next = b;
+			b = b->next;
+		}
+		tail = tail->next;
+	}
+	tail->next = a ? a : b;
+	return head.next;
+}
+
+
+/* Sorts the NULL-terminated chain of elements linked by their next pointer
+ * starting at <list> according to <cmp>, and returns the sorted chain. This is
+ * a bottom-up merge sort: bin N holds a sorted chain of 2^N elements or is
+ * empty, and each new element is carried through the bins like in a binary
+ * counter. Only the next pointers are used, and no memory is allocated.
+ */
+static inline struct mt_list *_mt_list_sort_chain(struct mt_list *list,
+                                                  int (*cmp)(const struct mt_list *, const struct mt_list *))
+{
+	struct mt_list *bins[sizeof(long) * 8];
+	struct mt_list *e;
+	unsigned int i, nbins = 0;
+
+	while (list) {
+		e = list;
+		list = list->next;
+		e->next = NULL;
+
+		/* older elements are in the bins, merge them first */
+		for (i = 0; i < nbins && bins[i]; i++) {
+			e = _mt_list_sort_merge(bins[i], e, cmp);
+			bins[i] = NULL;
+		}
+		if (i == nbins)
+			nbins++;
+		bins[i] = e;
+	}
+
+	for (e = NULL, i = 0; i < nbins; i++) {
+		if (bins[i])
+			e = _mt_list_sort_merge(bins[i], e, cmp);
+	}
+	return e;
+}
+
+#if defined(USE_THREAD)
+/* One part of a parallel mt_list_sort(). If <b> is NULL, chain <a> is sorted,
+ * otherwise chains <a> and <b> are merged. The result is placed into <a>.
+ */
+struct _mt_list_sort_job {
+	struct mt_list *a;
+	struct mt_list *b;
+	int (*cmp)(const struct mt_list *, const struct mt_list *);
+	pthread_t thr;
+	int started;
+};
+
+static inline void *_mt_list_sort_worker(void *arg)
+{
+	struct _mt_list_sort_job *job = (struct _mt_list_sort_job *)arg;
+
+	if (job->b)
+		job->a = _mt_list_sort_merge(job->a, job->b, job->cmp);
+	else
+		job->a = _mt_list_sort_chain(job->a, job->cmp);
+	return NULL;
+}
+
+/* Runs jobs <jobs> in parallel, using one thread per job except for the
+ * first one which is run by the calling thread. Jobs whose thread cannot be
+ * created are run by the calling thread as well.
+ */
+static inline void _mt_list_sort_run(struct _mt_list_sort_job *jobs, unsigned int nbjobs)
+{
+	unsigned int i;
+
+	for (i = 1; i < nbjobs; i++)
+		jobs[i].started = pthread_create(&jobs[i].thr, NULL, _mt_list_sort_worker, &jobs[i]) == 0;
+
+	_mt_list_sort_worker(&jobs[0]);
+
+	for (i = 1; i < nbjobs; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thr, NULL);
+		else
+			_mt_list_sort_worker(&jobs[i]);
+	}
+}
+#endif
+
+/* Sorts list <lh> in ascending order according to <cmp>, which works like
+ * qsort()'s comparison function and must return a negative, null or positive
+ * value when <a> is respectively lower than, equal to or greater than <b>.
+ * The sort is stable. The elements are first detached at once using
+ * mt_list_cut(), then sorted by relinking them without any allocation, and
+ * finally reinserted at once at the beginning of the list, so that elements
+ * appended in the mean time remain after them. Other threads thus see a list
+ * without these elements during the sort. When built with USE_THREAD, up to
+ * <nthreads> threads are used: the elements are split into equal parts that
+ * are sorted in parallel, then merged pairwise in parallel. For this, the
+ * function itself creates up to <nthreads> - 1 threads with pthread_create()
+ * for each round and joins them before the next one, and the calling thread
+ * takes its share of the work. Threads which cannot be created are replaced by
+ * the calling thread. Applications which must not create threads (e.g. those
+ * relying on a fixed thread pool or on signal masks) must pass 1. Otherwise,
+ * or if <nthreads> is lower than 2, the calling thread does all the work. Just
+ * like with mt_list_cut(), elements of this list must not be deleted, nor
+ * iterated over, by other threads during the operation.
+ */
+static MT_INLINE void mt_list_sort(struct mt_list *lh, int (*cmp)(const struct mt_list *a, const struct mt_list *b),
+                                   unsigned int nthreads)
+{
+	struct mt_list tmp;
+	struct mt_list ends;
+	struct mt_list *chain, *e, *p;
+#if defined(USE_THREAD)
+	struct _mt_list_sort_job jobs[MT_LIST_SORT_MAX_THREADS];
+	unsigned long count, part;
+	unsigned int i;
+#endif
+
+#if !defined(USE_THREAD)
+	(void)nthreads;
+#endif
+
+	mt_list_init(&tmp);
+	if (!mt_list_cut(lh, lh, &tmp))
+		return;
+
+	/* turn it into a NULL-terminated chain */
+	tmp.prev->next = NULL;
+	chain = tmp.next;
+
+#if defined(USE_THREAD)
+	if (nthreads > MT_LIST_SORT_MAX_THREADS)
+		nthreads = MT_LIST_SORT_MAX_THREADS;
+
+	for (count = 0, e = chain; e; e = e->next)
+		count++;
+
+	if (nthreads > count / 2)
+		nthreads = count / 2;
+
+	if (nthreads > 1) {
+		/* split into <nthreads> parts of <part> elements, the last one
+		 * getting the remainder.
+		 */
+		part = count / nthreads;
+		for (i = 0; i < nthreads; i++) {
+			jobs[i].a = chain;
+			jobs[i].b = NULL;
+			jobs[i].cmp = cmp;
+			if (i == nthreads - 1)
+				break;
+			for (count = 1; count < part; count++)
+				chain = chain->next;
+			e = chain;
+			chain = chain->next;
+			e->next = NULL;
+		}
+		_mt_list_sort_run(jobs, nthreads);
+
+		/* merge adjacent parts pairwise until only one remains */
+		while (nthreads > 1) {
+			unsigned int nbjobs = 0;
+
+			/* jobs are built in place at the beginning of the array */
+			for (i = 0; i + 1 < nthreads; i += 2) {
+				jobs[nbjobs] = jobs[i];
+				jobs[nbjobs].b = jobs[i + 1].a;
+				nbjobs++;
+			}
+			_mt_list_sort_run(jobs, nbjobs);
+
+			/* an odd last part is merged during next round */
+			if (nthreads & 1)
+				jobs[nbjobs++] = jobs[nthreads - 1];
+			nthreads = nbjobs;
+		}
+		chain = jobs[0].a;
+	}
+	else
+#endif
+		chain = _mt_list_sort_chain(chain, cmp);
+
+	/* rebuild the prev pointers and close the list */
+	for (p = &tmp, e = chain; e; p = e, e = e->next)
+		e->prev = p;
+	tmp.next = chain;
+	tmp.prev = p;
+	p->next = &tmp;
+
+	/* and reinsert everything in front of the list at once */
+	ends = mt_list_lock_next(lh);
+	MT_LIST_HOLD_END(ends.prev);
+	tmp.next->prev = ends.prev;
+	tmp.prev->next = ends.next;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	ends.next->prev = tmp.prev;
+	ends.prev->next = tmp.next;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
 /*****************************************************************************
  * The macros and functions below are only used by the iterators. These must *
  * not be used for other purposes unless the caller 100% complies with their *
@@ -1023,6 +3117,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_next(struct mt_list *el)
 {
 	struct mt_list *n, *n2;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_WALK, el);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		n = __atomic_exchange_n(&el->next, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -1039,6 +3134,8 @@ static MT_INLINE struct mt_list *_mt_list_lock_next(struct mt_list *el)
 		}
 		break;
 	}
+	MT_LIST_WATCH_LOCKED(el);
+	MT_LIST_DELAY_POINT(MT_LIST_TR_WALK);
 	return n;
 }
 
@@ -1052,6 +3149,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 {
 	struct mt_list *p, *p2;
 	unsigned long loops = 0;
+	MT_LIST_OP_BEGIN(MT_LIST_TR_WALK, el);
 
 	for (;; mt_list_cpu_relax(loops = loops * 8 + 7)) {
 		p = __atomic_exchange_n(&el->prev, MT_LIST_BUSY, __ATOMIC_RELAXED);
@@ -1066,6 +3164,8 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 		}
 		break;
 	}
+	MT_LIST_WATCH_LOCKED(el);
+	MT_LIST_DELAY_POINT(MT_LIST_TR_WALK);
 	return p;
 }
 
@@ -1083,6 +3183,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 #define _MT_LIST_FOR_EACH_ENTRY_LOCKED_OUTER(item, lh, lm, back)		\
 	for (/* init-expr: preset for one iteration */				\
 	     (back).prev = NULL,						\
+	     MT_LIST_HOLD_ITER_BEGIN(),						\
 	     (back).next = _mt_list_lock_next(lh),				\
 	     (item) = (void*)MT_LIST_BUSY;					\
 	     /* condition-expr: only one iteration */				\
@@ -1097,6 +3198,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 		 */								\
 		if (item == NULL && back.prev == NULL)				\
 			MT_UNREACHABLE();					\
+		MT_LIST_HOLD_ITER_END();					\
 		if (item != NULL) {						\
 			/* last visited item still exists or is the list's head	\
 			 * so we have to unlock it. back.prev may be null if 	\
@@ -1137,6 +3239,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 		struct mt_list *__tmp_next = back.next;				\
 		/* did not reach end of list yet */				\
 		back.next = _mt_list_lock_next(back.next);			\
+		MT_LIST_HOLD_ITER_STEP();					\
 		if (item != NULL) {						\
 			/* previous item was not deleted, we must unlock it */	\
 			if (back.prev) {					\
@@ -1170,6 +3273,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 #define _MT_LIST_FOR_EACH_ENTRY_UNLOCKED_OUTER(item, lh, lm, back)		\
 	for (/* init-expr: preset for one iteration */				\
 	     (back).prev = NULL,						\
+	     MT_LIST_HOLD_ITER_BEGIN(),						\
 	     (back).next = _mt_list_lock_next(lh),				\
 	     (item) = (void*)MT_LIST_BUSY;					\
 	     /* condition-expr: only one iteration */				\
@@ -1184,6 +3288,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 		 */								\
 		if (item == NULL && back.prev == NULL)				\
 			MT_UNREACHABLE();					\
+		MT_LIST_HOLD_ITER_END();					\
 		if (item != NULL) {						\
 			/* last visited item still exists or is the list's head	\
 			 * so we have to unlock it. back.prev may be null if 	\
@@ -1228,6 +3333,7 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 		struct mt_list *__tmp_next = back.next;				\
 		/* did not reach end of list yet */				\
 		back.next = _mt_list_lock_next(back.next);			\
+		MT_LIST_HOLD_ITER_STEP();					\
 		if (item != NULL) {						\
 			/* previous item was not deleted, we must unlock it */	\
 			if (back.prev) {					\
@@ -1251,4 +3357,277 @@ static MT_INLINE struct mt_list *_mt_list_lock_prev(struct mt_list *el)
 	     /* empty loop-expr */						\
 	)
 
+
+/* Flags for mt_list_snapshot() */
+#define MT_LIST_SNAP_STRICT  0x00000001  /* keep the head frozen during the walk */
+
+/* Walks over list <lh> and calls <getref> on each element with <ctx>. The
+ * callback is expected to take a reference on the element (e.g. increment a
+ * refcount) and to return a pointer to it (e.g. the structure containing the
+ * element), which is then stored into <array>. If the callback returns NULL,
+ * the element is skipped (e.g. because it is being destroyed). At most <max>
+ * pointers are stored and their number is returned. The callback is called
+ * with the element and its two links locked, just like in the iterators, and
+ * only the current element and its links are locked at any time, so that the
+ * walk only blocks other threads for the duration of the callback. It must be
+ * short and must not perform any operation on the list. The slow processing of
+ * the elements is then performed on the array, outside of any list lock,
+ * before the references are released by the caller. If <flags> contains
+ * MT_LIST_SNAP_STRICT, the link between the head and the first element remains
+ * locked during the whole walk, so that no element may be popped or inserted
+ * at the beginning of the list, nor deleted from there, until the walk is
+ * complete. For a FIFO this guarantees that all elements present when the
+ * walk starts are reported, though elements appended during the walk may be
+ * reported as well. It must not be used by a thread already holding a lock on
+ * this list. Example:
+ *
+ *   nb = mt_list_snapshot(&conns, (void **)tab, 1000, conn_getref, NULL, 0);
+ *   for (i = 0; i < nb; i++) {
+ *       dump_conn(tab[i]);
+ *       conn_putref(tab[i]);
+ *   }
+ */
+static MT_INLINE unsigned int mt_list_snapshot(struct mt_list *lh, void **array, unsigned int max,
+                                               void *(*getref)(struct mt_list *el, void *ctx), void *ctx,
+                                               unsigned int flags)
+{
+	struct mt_list *cur, *n, *nn, *first;
+	unsigned int nb = 0;
+	void *ref;
+
+	/* <cur> is the last element whose next link is locked, <n> is the
+	 * element this link leads to.
+	 */
+	cur = lh;
+	n = first = _mt_list_lock_next(lh);
+	while (n != lh && nb < max) {
+		nn = _mt_list_lock_next(n);
+
+		/* <n> is fully locked now */
+		ref = getref(n, ctx);
+		if (ref)
+			array[nb++] = ref;
+
+		if (cur != lh || !(flags & MT_LIST_SNAP_STRICT))
+			_mt_list_unlock_prev(n, cur);
+		cur = n;
+		n = nn;
+	}
+
+	_mt_list_unlock_next(cur, n);
+	if (cur != lh && (flags & MT_LIST_SNAP_STRICT))
+		_mt_list_unlock_next(lh, first);
+	return nb;
+}
+
+/* Return values of mt_list_foreach() callbacks, STOP may be combined with
+ * REMOVE.
+ */
+#define MT_LIST_FE_CONT         0x00000000  /* continue with the next element */
+#define MT_LIST_FE_STOP         0x00000001  /* stop after this element */
+#define MT_LIST_FE_REMOVE       0x00000002  /* remove this element */
+#define MT_LIST_FE_REMOVE_STOP  (MT_LIST_FE_REMOVE | MT_LIST_FE_STOP)
+
+/* Flags for mt_list_foreach() */
+#define MT_LIST_FE_UNLOCKED     0x00000001  /* pass the elements unlocked */
+
+/* Walks over list <lh> and calls <cb> on each element with <ctx>, just like
+ * MT_LIST_FOR_EACH_ENTRY_LOCKED() does, but as a function: it does not expand
+ * to a large code at every call site, it may be called from other languages,
+ * it shows as a single symbol in profiles, and the callback may return from
+ * anywhere. The callback returns a combination of MT_LIST_FE_* values telling
+ * whether the element is to be removed and whether the walk stops there. The
+ * callback is called with the element and its two links locked, or if <flags>
+ * contains MT_LIST_FE_UNLOCKED, with the element unlocked and looping over
+ * itself but its neighbours still locked, like MT_LIST_FOR_EACH_ENTRY_UNLOCKED()
+ * does. The same restrictions apply: the callback must not perform any
+ * operation on the list, and the unlocked mode may only be used when no other
+ * thread may access the elements directly. A removed element is not accessed
+ * anymore once the callback returns, so that the callback may free it. In the
+ * locked mode it is left locked and must be reinitialized before being reused.
+ * The number of elements passed to the callback is returned. Example:
+ *
+ *   static int expire_cb(struct mt_list *el, void *ctx)
+ *   {
+ *       struct task *t = MT_LIST_ELEM(el, struct task *, list);
+ *
+ *       if (t->expire > *(uint64_t *)ctx)
+ *           return MT_LIST_FE_CONT;
+ *       free(t);
+ *       return MT_LIST_FE_REMOVE;
+ *   }
+ *
+ *   mt_list_foreach(&timers, expire_cb, &now, 0);
+ */
+static __attribute__((noinline, unused))
+unsigned int mt_list_foreach(struct mt_list *lh, int (*cb)(struct mt_list *el, void *ctx), void *ctx,
+                             unsigned int flags)
+{
+	struct mt_list *cur, *n, *nn;
+	unsigned int nb = 0;
+	int ret;
+
+	/* <cur> is the last kept element whose next link is locked, <n> is the
+	 * element this link leads to.
+	 */
+	MT_LIST_HOLD_CALL_BEGIN();
+	cur = lh;
+	n = _mt_list_lock_next(lh);
+	while (n != lh) {
+		nn = _mt_list_lock_next(n);
+		MT_LIST_HOLD_ITER_STEP();
+
+		/* <n> is fully locked now */
+		if (flags & MT_LIST_FE_UNLOCKED)
+			mt_list_unlock_self(n);
+		ret = cb(n, ctx);
+		nb++;
+
+		if (!(ret & MT_LIST_FE_REMOVE)) {
+			if (flags & MT_LIST_FE_UNLOCKED) {
+				n->next = MT_LIST_BUSY;
+				__atomic_thread_fence(__ATOMIC_RELEASE);
+			}
+			_mt_list_unlock_prev(n, cur);
+			cur = n;
+		}
+		n = nn;
+		if (ret & MT_LIST_FE_STOP)
+			break;
+	}
+	MT_LIST_HOLD_ITER_END();
+
+	if (nb && n == cur) {
+		/* all elements were removed, the head's prev pointer was
+		 * locked when reaching it from the last one.
+		 */
+		cur->prev = cur;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+	_mt_list_unlock_next(cur, n);
+	return nb;
+}
+
+/* With MT_LIST_HOLD, mt_list_foreach() is called through a macro designating
+ * the call site for the hold-time statistics.
+ */
+#if defined(MT_LIST_HOLD)
+#define mt_list_foreach(lh, cb, ctx, flags) (_mt_list_hold_site = MT_LIST_HOLD_SITE(), mt_list_foreach(lh, cb, ctx, flags))
+#endif
+
+/* Maximum number of elements relinked at once by mt_list_relink() */
+#ifndef MT_LIST_RELINK_MAX
+#define MT_LIST_RELINK_MAX 256
+#endif
+
+/* Performs one pass of relinking of list <lh> in ascending address order, for
+ * lists where the order of elements doesn't matter (pools, sets). Long-lived
+ * lists end up linked in an order unrelated to memory placement, making each
+ * step of a scan a random memory access, while scanning elements in address
+ * order lets the hardware prefetcher do its job. The list is walked like the
+ * iterators do, by locking the links hand over hand up to <window>
+ * consecutive elements, which are then all fully locked just as if each of
+ * them had been locked with mt_list_lock_full(), without having to unlink
+ * them. They are relinked between them in address order. The first half of
+ * them is unlocked and the walk continues with the second half still locked,
+ * so that elements may progress further in the list at each window. <window>
+ * is bounded to [2..MT_LIST_RELINK_MAX]. Only the elements of the current
+ * window and their links are locked at any time, so the list remains usable
+ * by other threads during the operation.
+ *
+ * This works like a bubble sort carrying half a window: each pass moves the
+ * <window>/2 highest addresses it meets to their final place at the end, but
+ * lets the other elements move backwards by at most half a window. A shuffled
+ * list of N elements thus needs about 2*N/<window> passes to be fully ordered,
+ * which is O(N^2/<window>) element visits overall: about 1000 passes for 8192
+ * elements with a window of 16, and about 500 passes (2.4s) for 65536 elements
+ * with a window of 256. Scans only get faster once long runs of neighbouring
+ * addresses have been formed, so a few passes bring nothing and only the last
+ * ones matter (see tests/bench-relink.c to measure it). This is meant to
+ * slowly maintain the order of moderately sized lists from a background task,
+ * using a large window. A large shuffled list is better ordered once with
+ * mt_list_sort() comparing the addresses, which is O(N*log(N)) but hides the
+ * elements from other threads during the sort. The number of elements which
+ * changed position is returned, so the caller may stop once it returns zero.
+ * It must not be used by a thread already holding a lock on this list, nor on
+ * a list walked without locking (e.g. by mt_list_own_* functions), and it may
+ * not be used on lists whose order matters, obviously.
+ */
+static MT_INLINE unsigned int mt_list_relink(struct mt_list *lh, unsigned int window)
+{
+	struct mt_list *win[MT_LIST_RELINK_MAX];
+	struct mt_list *cur, *n, *e;
+	unsigned int nb = 0, moved = 0, keep;
+	unsigned int i, j;
+
+	if (window > MT_LIST_RELINK_MAX)
+		window = MT_LIST_RELINK_MAX;
+	if (window < 2)
+		window = 2;
+
+	/* <cur> is the last element whose next link is locked, <n> is the
+	 * element this link leads to, and win[] contains the <nb> elements
+	 * after <cur> and before <n>, which are all fully locked.
+	 */
+	cur = lh;
+	n = _mt_list_lock_next(lh);
+	while (1) {
+		while (nb < window && n != lh) {
+			win[nb++] = n;
+			n = _mt_list_lock_next(n);
+		}
+
+		/* insertion sort of the window by ascending addresses */
+		for (i = 1; i < nb; i++) {
+			e = win[i];
+			for (j = i; j > 0 && (uintptr_t)win[j - 1] > (uintptr_t)e; j--)
+				win[j] = win[j - 1];
+			if (j != i) {
+				win[j] = e;
+				moved++;
+			}
+		}
+
+		/* keep half of the window locked unless we've reached the end */
+		keep = (n == lh) ? 0 : nb / 2;
+
+		/* relink the elements to release, all pointers are currently
+		 * locked so the order doesn't matter, except for the first one
+		 * which opens the way to the window.
+		 */
+		for (i = 0; i < nb - keep; i++) {
+			win[i]->prev = i ? win[i - 1] : cur;
+			if (i + 1 < nb - keep)
+				win[i]->next = win[i + 1];
+		}
+
+		if (!keep) {
+			/* end of list: link the last one to <n> and release all */
+			if (nb) {
+				win[nb - 1]->next = n;
+				n->prev = win[nb - 1];
+				__atomic_thread_fence(__ATOMIC_RELEASE);
+				cur->next = win[0];
+			}
+			else
+				_mt_list_unlock_next(cur, n);
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			break;
+		}
+
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		cur->next = win[0];
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		/* the last released element keeps its next link locked and
+		 * becomes the new boundary.
+		 */
+		cur = win[nb - keep - 1];
+		for (i = 0; i < keep; i++)
+			win[i] = win[nb - keep + i];
+		nb = keep;
+	}
+	return moved;
+}
+
 #endif /* _MT_LIST_H */
@@ -0,0 +1,387 @@
+/*
+ * include/mt_list.hpp
+ *
+ * C++ container based on multi-thread aware circular lists.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _MT_LIST_HPP
+#define _MT_LIST_HPP
+
+/* inline static members and std::launder() require C++17 */
+#if __cplusplus < 201703L
+#error "mt_list.hpp requires C++17 or newer (e.g. -std=c++17)"
+#endif
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <utility>
+#include <mt_list.h>
+
+/* number of nodes a thread moves at once between its pool and the shared one */
+#ifndef MT_LIST_POOL_BATCH
+#define MT_LIST_POOL_BATCH 64
+#endif
+
+namespace mt {
+
+namespace detail {
+
+/* Pool of nodes of <Size> bytes aligned on <Align>, which all start with a
+ * struct mt_list used to chain them while they're free. Each thread has its
+ * own pool, an owned list accessed without any atomic operation. Nodes are
+ * returned to the pool of the thread which releases them, so that when some
+ * threads allocate and other ones release, the latter would accumulate nodes
+ * that the former would have to allocate again. Thus a thread holding twice
+ * MT_LIST_POOL_BATCH nodes publishes a batch of them into a shared list with
+ * a single lock, and a thread running out of nodes takes the whole shared list
+ * at once using mt_list_behead(). This way, once the number of nodes in use
+ * has reached its peak, nodes are only recycled and never allocated anymore.
+ * Nodes are never freed, those of exiting threads are published. New nodes are
+ * zeroed, and the pool only uses their struct mt_list, so that their users may
+ * keep state in them across recycling. A thread's pool may be destroyed before
+ * objects still releasing nodes from the same thread, such as lists with
+ * static storage whose destructors run after the main thread's thread_local
+ * objects. Nodes are then directly published, and new ones are allocated.
+ */
+template <std::size_t Size, std::size_t Align>
+class node_pool {
+	struct mt_list local;    /* owned list of free nodes */
+	unsigned int count;      /* number of nodes in <local> */
+
+	static inline struct mt_list shared = { &node_pool::shared, &node_pool::shared };
+	static inline thread_local bool gone;   /* the thread's pool was destroyed */
+
+	node_pool() : count(0)
+	{
+		mt_list_init(&local);
+	}
+
+	~node_pool()
+	{
+		gone = true;
+		mt_list_own_publish(&shared, &local);
+	}
+
+	/* returns the calling thread's pool, which must not be gone */
+	static node_pool &get()
+	{
+		static thread_local node_pool pool;
+		return pool;
+	}
+
+	/* returns a new zeroed node */
+	static void *fresh()
+	{
+		return std::memset(::operator new(Size, std::align_val_t(Align)), 0, Size);
+	}
+
+	/* returns a node from this pool, or a new one if all pools are empty */
+	void *take()
+	{
+		struct mt_list *n;
+
+		if (!count) {
+			n = mt_list_behead(&shared);
+			if (n) {
+				mt_list_own_attach(&local, n);
+				do {
+					count++;
+				} while ((n = n->next) != &local);
+			}
+		}
+
+		n = mt_list_own_pop(&local);
+		if (!n)
+			return fresh();
+		count--;
+		return n;
+	}
+
+	/* puts node <ptr> back into this pool */
+	void put(void *ptr)
+	{
+		struct mt_list batch, *n;
+		unsigned int i;
+
+		mt_list_own_insert(&local, mt_list_init(static_cast<struct mt_list *>(ptr)));
+		if (++count < 2 * MT_LIST_POOL_BATCH)
+			return;
+
+		/* publish the least recently used nodes */
+		mt_list_init(&batch);
+		for (i = 0; i < MT_LIST_POOL_BATCH; i++) {
+			n = local.prev;
+			mt_list_own_delete(n);
+			mt_list_own_insert(&batch, n);
+		}
+		count -= MT_LIST_POOL_BATCH;
+		mt_list_own_publish(&shared, &batch);
+	}
+
+public:
+	node_pool(const node_pool &) = delete;
+	node_pool &operator=(const node_pool &) = delete;
+
+	/* Returns a node from the calling thread's pool, or a newly allocated one
+	 * if all pools are empty or if the thread's pool is gone. Throws
+	 * std::bad_alloc on allocation failure.
+	 */
+	static void *alloc()
+	{
+		return gone ? fresh() : get().take();
+	}
+
+	/* Puts node <ptr> back into the calling thread's pool, or directly into
+	 * the shared list if the thread's pool is gone. The node's contents are
+	 * lost, except for what follows its struct mt_list.
+	 */
+	static void release(void *ptr)
+	{
+		if (gone) {
+			/* unlocks <shared> last, as mt_list_behead() requires */
+			mt_list_try_append(&shared, mt_list_init(static_cast<struct mt_list *>(ptr)));
+			return;
+		}
+		get().put(ptr);
+	}
+};
+
+} /* namespace detail */
+
+
+/* A multi-thread aware list of values of type T, for types which cannot embed
+ * a struct mt_list. Values are stored into nodes taken from a per-thread node
+ * pool (see detail::node_pool above), so that once the list has reached its
+ * peak size, no allocation is performed anymore. T only needs to be move-
+ * constructible. Any number of threads may add and remove values at once,
+ * including erasing values that other threads are popping at the same time. The
+ * list itself may not be copied nor moved since its head is linked with the
+ * nodes, and it must not be destroyed while being used by other threads.
+ */
+template <typename T>
+class list {
+	struct node {
+		struct mt_list link;          /* must be first for the pool */
+		unsigned long state;          /* generation << 2 | state below */
+		alignas(T) unsigned char storage[sizeof(T)];
+
+		T *value() { return std::launder(reinterpret_cast<T *>(storage)); }
+	};
+
+	/* State of a node, in the two lowest bits of node::state. The upper
+	 * bits hold a generation number which is incremented each time the node
+	 * receives a new value, so that a handle on a recycled node is detected.
+	 * A value belongs to whoever moves its node out of LIVE:
+	 *   - LIVE: the node is in the list with its value;
+	 *   - ERASING: erase() claimed the value and is unlinking the node;
+	 *   - ABANDONED: erase() found the node detached by a thread popping
+	 *     it, and left it to this thread to destroy;
+	 *   - OUT: the value was taken, or the node is free.
+	 */
+	enum : unsigned long { LIVE = 0, ERASING = 1, ABANDONED = 2, OUT = 3, STATES = 3 };
+
+	typedef detail::node_pool<sizeof(node), alignof(node)> pool;
+
+	struct mt_list head;
+
+	/* returns a node holding a value constructed from <args> */
+	template <typename... Args>
+	static node *make(Args &&...args)
+	{
+		node *n = static_cast<node *>(pool::alloc());
+
+		try {
+			new (n->storage) T(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			pool::release(n);
+			throw;
+		}
+		mt_list_init(&n->link);
+		__atomic_store_n(&n->state, (n->state | STATES) + 1, __ATOMIC_RELAXED);
+		return n;
+	}
+
+	/* destroys the value of detached node <n> and releases it */
+	static void destroy(node *n)
+	{
+		n->value()->~T();
+		pool::release(n);
+	}
+
+	/* Called by a thread which detached node <n> from the list, to take its
+	 * value. Returns true if it did, or false if erase() claimed the value
+	 * first, in which case the node must not be used anymore.
+	 */
+	static bool claim(node *n)
+	{
+		unsigned long s = __atomic_fetch_or(&n->state, OUT, __ATOMIC_ACQ_REL);
+
+		if ((s & STATES) == ABANDONED) {
+			/* erase() is done with the node */
+			destroy(n);
+			return false;
+		}
+		return (s & STATES) == LIVE;
+	}
+
+public:
+	/* Designates a value added to the list, for use with erase(). It may be
+	 * passed to erase() even after its value was removed by another thread,
+	 * since it records the generation of the node, so that erase() simply
+	 * fails once the node was reused for another value.
+	 */
+	class handle {
+		friend class list;
+		node *n;
+		unsigned long gen;
+
+		explicit handle(node *n) : n(n), gen(__atomic_load_n(&n->state, __ATOMIC_RELAXED)) { }
+	public:
+		handle() : n(nullptr), gen(0) { }
+		explicit operator bool() const { return n != nullptr; }
+
+		/* returns the value, which the caller must know is still in the
+		 * list and cannot be removed meanwhile.
+		 */
+		T &operator*() const { return *n->value(); }
+		T *operator->() const { return n->value(); }
+	};
+
+	list()
+	{
+		mt_list_init(&head);
+	}
+
+	~list()
+	{
+		clear();
+	}
+
+	list(const list &) = delete;
+	list &operator=(const list &) = delete;
+
+	/* Constructs a value from <args> at the end or at the beginning of the
+	 * list, and returns its handle.
+	 */
+	template <typename... Args>
+	handle emplace_back(Args &&...args)
+	{
+		node *n = make(std::forward<Args>(args)...);
+		handle h(n); /* before another thread may remove it */
+
+		mt_list_append(&head, &n->link);
+		return h;
+	}
+
+	template <typename... Args>
+	handle emplace_front(Args &&...args)
+	{
+		node *n = make(std::forward<Args>(args)...);
+		handle h(n); /* before another thread may remove it */
+
+		mt_list_insert(&head, &n->link);
+		return h;
+	}
+
+	handle push_back(const T &v)  { return emplace_back(v); }
+	handle push_back(T &&v)       { return emplace_back(std::move(v)); }
+	handle push_front(const T &v) { return emplace_front(v); }
+	handle push_front(T &&v)      { return emplace_front(std::move(v)); }
+
+	/* Removes the first value of the list and returns it, or an empty
+	 * optional if the list is empty. If moving the value out throws, the
+	 * value is lost but its node is still released.
+	 */
+	std::optional<T> pop_front()
+	{
+		struct mt_list *l;
+		node *n;
+
+		do {
+			l = mt_list_pop(&head);
+			if (!l)
+				return std::nullopt;
+			n = MT_LIST_ELEM(l, node *, link);
+		} while (!claim(n));
+
+		struct guard {
+			node *n;
+			~guard() { destroy(n); }
+		} g = { n };
+
+		return std::optional<T>(std::move(*g.n->value()));
+	}
+
+	/* Removes and destroys the value designated by <h>. Returns true if it
+	 * was removed, or false if it was not in the list anymore. The value is
+	 * claimed before its node is unlinked. If a thread popping the list has
+	 * detached the node meanwhile, it leaves the value to us, and the last
+	 * one of us to be done with the node destroys the value and releases
+	 * the node.
+	 */
+	bool erase(handle h)
+	{
+		unsigned long s = h.gen;
+
+		if (!h.n || !__atomic_compare_exchange_n(&h.n->state, &s, s | ERASING, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return false;
+
+		if (!mt_list_delete(&h.n->link)) {
+			s |= ERASING;
+			if (__atomic_compare_exchange_n(&h.n->state, &s, (s & ~STATES) | ABANDONED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return true; /* the popper will destroy it */
+		}
+		destroy(h.n);
+		return true;
+	}
+
+	/* Returns true if the list looks empty. The result is only a hint when
+	 * other threads may add or remove values at the same time.
+	 */
+	bool empty() const
+	{
+		return mt_list_isempty(&head);
+	}
+
+	/* Removes and destroys all values */
+	void clear()
+	{
+		struct mt_list *l;
+		node *n;
+
+		while ((l = mt_list_pop(&head))) {
+			n = MT_LIST_ELEM(l, node *, link);
+			if (claim(n))
+				destroy(n);
+		}
+	}
+};
+
+} /* namespace mt */
+
+#endif /* _MT_LIST_HPP */
@@ -0,0 +1,139 @@
+/*
+ * include/mt_list_bag.h
+ *
+ * Unordered bags of elements based on multi-thread aware circular lists.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _MT_LIST_BAG_H
+#define _MT_LIST_BAG_H
+
+#include <mt_list.h>
+
+/* A bag is a list in which the order of elements doesn't matter, such as a
+ * free pool. Instead of having all threads compete on the same head, the list
+ * contains a number of anchors, which are permanent elements spread along the
+ * list. Each thread uses one of them as its hint, inserts elements right after
+ * it and takes the element which follows it, so that threads using different
+ * anchors work on different links. When the elements following the hint are
+ * exhausted, the next anchors are tried in turn. Anchor 0 serves as the
+ * list's head. The anchors array is provided by the caller and must remain
+ * valid as long as the bag is used. Anchors must be recognized by anyone
+ * iterating over the bag, using mt_list_bag_is_anchor().
+ */
+struct mt_list_bag {
+	struct mt_list *anchors;  /* array of <nbanchors> anchors, [0]=head */
+	unsigned int nbanchors;   /* number of anchors, at least 1 */
+};
+
+
+/* Returns a pointer of type <t> to the structure containing a member of type
+ * mt_list called <m> that was taken from bag <b> using hint <h>. If the bag is
+ * empty, NULL is returned instead. Example:
+ *
+ *   conn = MT_LIST_BAG_TAKE(&idle_conns, tid, struct conn *, list);
+ */
+#define MT_LIST_BAG_TAKE(b, h, t, m)					\
+	({								\
+		struct mt_list *_n = mt_list_bag_take(b, h);		\
+		(_n ? MT_LIST_ELEM(_n, t, m) : NULL);			\
+	})
+
+
+/* Initializes bag <bag> with the <nb> anchors in array <anchors>, which must
+ * contain at least one entry. The anchors are all linked together and the bag
+ * is empty. The bag is returned.
+ */
+static inline struct mt_list_bag *mt_list_bag_init(struct mt_list_bag *bag, struct mt_list *anchors, unsigned int nb)
+{
+	unsigned int i;
+
+	bag->anchors = anchors;
+	bag->nbanchors = nb;
+	mt_list_init(&anchors[0]);
+	for (i = 1; i < nb; i++)
+		mt_list_append(&anchors[0], &anchors[i]);
+	return bag;
+}
+
+
+/* Returns true if <el> is one of the anchors of bag <bag>, otherwise false.
+ * This must be used to skip anchors when iterating over the bag.
+ */
+static inline long mt_list_bag_is_anchor(const struct mt_list_bag *bag, const struct mt_list *el)
+{
+	return (size_t)((char *)el - (char *)bag->anchors) < bag->nbanchors * sizeof(*el);
+}
+
+
+/* Predicate used by mt_list_bag_take() with mt_list_pop_if() to only detach
+ * elements which are not anchors of the bag passed in <ctx>.
+ */
+static inline long _mt_list_bag_not_anchor(struct mt_list *el, void *ctx)
+{
+	return !mt_list_bag_is_anchor((const struct mt_list_bag *)ctx, el);
+}
+
+
+/* Adds element <el> into bag <bag>, right after the anchor designated by
+ * <hint>, which is usually the caller's thread number. Any value is valid
+ * since it is reduced to the number of anchors. It is assumed that the
+ * element cannot already be part of a list so it isn't checked for this.
+ */
+static inline void mt_list_bag_put(struct mt_list_bag *bag, unsigned int hint, struct mt_list *el)
+{
+	mt_list_insert(&bag->anchors[hint % bag->nbanchors], el);
+}
+
+
+/* Takes one element from bag <bag> and returns it in detached form, or NULL
+ * if the bag is empty. The element following the anchor designated by <hint>
+ * is taken first. If it is another anchor, the next anchors are tried in
+ * turn, which ends on the head (anchor 0) for the last hints. Anchors that
+ * are immediately followed by another anchor are skipped using only a read,
+ * so that scanning an empty bag doesn't lock anything.
+ */
+static MT_INLINE struct mt_list *mt_list_bag_take(struct mt_list_bag *bag, unsigned int hint)
+{
+	struct mt_list *a, *n;
+	unsigned int i;
+
+	hint %= bag->nbanchors;
+	for (i = 0; i < bag->nbanchors; i++) {
+		a = &bag->anchors[hint];
+		if (++hint >= bag->nbanchors)
+			hint = 0;
+
+		n = __atomic_load_n(&a->next, __ATOMIC_RELAXED);
+		if (n != MT_LIST_BUSY && mt_list_bag_is_anchor(bag, n))
+			continue;
+
+		n = mt_list_pop_if(a, _mt_list_bag_not_anchor, bag);
+		if (n)
+			return n;
+	}
+	return NULL;
+}
+
+#endif /* _MT_LIST_BAG_H */
@@ -0,0 +1,325 @@
+/*
+ * include/mt_list_codel.h
+ *
+ * Sojourn-time tracking and delay-based queue management for multi-thread
+ * aware circular lists.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _MT_LIST_CODEL_H
+#define _MT_LIST_CODEL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <mt_list.h>
+
+/* sojourn times are accounted in buckets of powers of two nanoseconds */
+#define MT_LIST_CODEL_BUCKETS 40
+
+/* An element of a codel queue. It must be embedded into the queued structure
+ * in place of a struct mt_list, and is stamped with its enqueue date.
+ */
+struct mt_list_codel_elem {
+	struct mt_list list;
+	uint64_t date;               /* CLOCK_MONOTONIC enqueue date in ns */
+};
+
+struct mt_list_codel;
+
+/* called with each element dropped by the control law, in detached form */
+typedef void (*mt_list_codel_drop_cb)(struct mt_list_codel *q, struct mt_list_codel_elem *el, void *ctx);
+
+/* A FIFO queue which measures the time elements spend in it (their sojourn
+ * time) and optionally applies the CoDel control law: once the sojourn time
+ * of all dequeued elements has remained above <target> for at least
+ * <interval>, elements are passed to the drop callback instead of being
+ * returned, at a rate increasing with the square root of the number of drops,
+ * until the sojourn time falls below the target again. This way a standing
+ * queue is drained while bursts shorter than the interval are absorbed. Any
+ * number of threads may enqueue and dequeue. The control law's state is only
+ * updated by one consumer at a time: a consumer which finds it busy simply
+ * returns the element without applying the law. The head, the control law's
+ * state and the statistics are placed on separate cache lines.
+ */
+struct mt_list_codel {
+	struct mt_list head;
+
+	/* settings and control law state */
+	uint64_t target __attribute__((aligned(64))); /* ns, 0=no control law */
+	uint64_t interval;           /* ns */
+	mt_list_codel_drop_cb drop;  /* NULL=no control law */
+	void *ctx;                   /* passed to <drop> */
+	uint64_t first_above;        /* date sojourn will have been above target for <interval>, 0=below */
+	uint64_t drop_next;          /* date of the next drop when dropping */
+	uint32_t count;              /* drops since entering the dropping state */
+	uint32_t lastcount;          /* <count> when last entering the dropping state */
+	uint32_t dropping;           /* non-zero when in the dropping state */
+	uint32_t busy;               /* non-zero when a consumer updates the state */
+
+	/* statistics, updated with relaxed atomic operations */
+	uint64_t drops __attribute__((aligned(64)));
+	uint64_t hist[MT_LIST_CODEL_BUCKETS]; /* sojourn times of dequeued and dropped elements */
+};
+
+
+/* Returns a pointer of type <t> to the structure containing a member of type
+ * mt_list_codel_elem called <m> that was dequeued from codel queue <q>. If the
+ * queue is empty, NULL is returned instead. Example:
+ *
+ *   while ((req = MT_LIST_CODEL_DEQUEUE(&requests, struct request *, qel))) ...
+ */
+#define MT_LIST_CODEL_DEQUEUE(q, t, m)					\
+	({								\
+		struct mt_list_codel_elem *_e = mt_list_codel_dequeue(q); \
+		(_e ? MT_LIST_ELEM(_e, t, m) : NULL);			\
+	})
+
+
+static inline uint64_t _mt_list_codel_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* returns the integer square root of <x> */
+static inline uint64_t _mt_list_codel_sqrt(uint64_t x)
+{
+	uint64_t r = 0, bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+	while (bit) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else
+			r >>= 1;
+		bit >>= 2;
+	}
+	return r;
+}
+
+
+/* Initializes codel queue <q> as an empty queue. If <target> (in ns) and
+ * <drop> are both set, the control law is applied using <target> and
+ * <interval> (in ns, typically 20 times the target, e.g. 5ms and 100ms) and
+ * dropped elements are passed to <drop> along with <ctx>. The callback may
+ * free them or divert them to another list, but must not dequeue from <q>.
+ * Otherwise only sojourn times are measured. The queue is returned.
+ */
+static inline struct mt_list_codel *mt_list_codel_init(struct mt_list_codel *q, uint64_t target, uint64_t interval,
+                                                       mt_list_codel_drop_cb drop, void *ctx)
+{
+	mt_list_init(&q->head);
+	q->target      = target;
+	q->interval    = interval;
+	q->drop        = drop;
+	q->ctx         = ctx;
+	q->first_above = 0;
+	q->drop_next   = 0;
+	q->count       = 0;
+	q->lastcount   = 0;
+	q->dropping    = 0;
+	q->busy        = 0;
+	q->drops       = 0;
+	memset(q->hist, 0, sizeof(q->hist));
+	return q;
+}
+
+
+/* Stamps element <el> with the current date and appends it to codel queue
+ * <q>. The element must not be part of any list.
+ */
+static inline void mt_list_codel_enqueue(struct mt_list_codel *q, struct mt_list_codel_elem *el)
+{
+	el->date = _mt_list_codel_now();
+	mt_list_append(&q->head, &el->list);
+}
+
+
+/* Pops the first element of codel queue <q>, accounts its sojourn time and
+ * returns it, or NULL if the queue is empty. When <ok_to_drop> is not NULL,
+ * the control law's first_above date is updated and <*ok_to_drop> indicates
+ * whether the sojourn time has remained above target for a whole interval.
+ * An element which leaves the queue empty is never considered for a drop, so
+ * that a queue is never starved by the law.
+ */
+static inline struct mt_list_codel_elem *_mt_list_codel_pop(struct mt_list_codel *q, uint64_t now, int *ok_to_drop)
+{
+	struct mt_list_codel_elem *el;
+	struct mt_list *n;
+	uint64_t sojourn;
+	unsigned int b;
+
+	n = mt_list_pop(&q->head);
+	if (!n) {
+		if (ok_to_drop) {
+			q->first_above = 0;
+			*ok_to_drop = 0;
+		}
+		return NULL;
+	}
+
+	el = MT_LIST_ELEM(n, struct mt_list_codel_elem *, list);
+	sojourn = now > el->date ? now - el->date : 0;
+	b = sojourn ? 63 - __builtin_clzll(sojourn) : 0;
+	if (b >= MT_LIST_CODEL_BUCKETS)
+		b = MT_LIST_CODEL_BUCKETS - 1;
+	__atomic_fetch_add(&q->hist[b], 1, __ATOMIC_RELAXED);
+
+	if (!ok_to_drop)
+		return el;
+
+	*ok_to_drop = 0;
+	if (sojourn < q->target ||
+	    __atomic_load_n(&q->head.next, __ATOMIC_RELAXED) == &q->head) {
+		/* below target, or we're not building a standing queue */
+		q->first_above = 0;
+	}
+	else if (!q->first_above)
+		q->first_above = now + q->interval;
+	else if (now >= q->first_above)
+		*ok_to_drop = 1;
+	return el;
+}
+
+/* passes element <el> to the drop callback of queue <q> */
+static inline void _mt_list_codel_drop(struct mt_list_codel *q, struct mt_list_codel_elem *el)
+{
+	__atomic_fetch_add(&q->drops, 1, __ATOMIC_RELAXED);
+	q->drop(q, el, q->ctx);
+}
+
+/* returns the date of the next drop after <t> according to the control law */
+static inline uint64_t _mt_list_codel_law(const struct mt_list_codel *q, uint64_t t)
+{
+	/* interval / sqrt(count), with 10 extra bits of precision */
+	return t + (q->interval << 10) / _mt_list_codel_sqrt((uint64_t)q->count << 20);
+}
+
+
+/* Dequeues the first element of codel queue <q> and returns it, or NULL if
+ * the queue is empty. Its sojourn time is accounted into the queue's
+ * histogram. When the control law is enabled (see mt_list_codel_init()),
+ * elements whose sojourn time remained above target for too long may be
+ * passed to the drop callback first, in which case the next element is
+ * returned instead. The law is only applied by one consumer at a time, the
+ * other ones just pop elements in the meantime.
+ */
+static MT_INLINE struct mt_list_codel_elem *mt_list_codel_dequeue(struct mt_list_codel *q)
+{
+	struct mt_list_codel_elem *el;
+	uint64_t now = _mt_list_codel_now();
+	int ok_to_drop;
+
+	if (!q->target || !q->drop ||
+	    __atomic_exchange_n(&q->busy, 1, __ATOMIC_ACQUIRE))
+		return _mt_list_codel_pop(q, now, NULL);
+
+	el = _mt_list_codel_pop(q, now, &ok_to_drop);
+	if (q->dropping) {
+		if (!ok_to_drop) {
+			/* sojourn time went below target, leave the dropping state */
+			q->dropping = 0;
+		}
+		while (q->dropping && now >= q->drop_next) {
+			_mt_list_codel_drop(q, el);
+			q->count++;
+			el = _mt_list_codel_pop(q, now, &ok_to_drop);
+			if (!ok_to_drop)
+				q->dropping = 0;
+			else
+				q->drop_next = _mt_list_codel_law(q, q->drop_next);
+		}
+	}
+	else if (ok_to_drop) {
+		_mt_list_codel_drop(q, el);
+		el = _mt_list_codel_pop(q, now, &ok_to_drop);
+		q->dropping = 1;
+
+		/* if we left the dropping state recently, resume with a drop
+		 * rate close to the one we had.
+		 */
+		if (q->count - q->lastcount > 1 && (int64_t)(now - q->drop_next) < (int64_t)(16 * q->interval))
+			q->count = q->count - q->lastcount;
+		else
+			q->count = 1;
+		q->lastcount = q->count;
+		q->drop_next = _mt_list_codel_law(q, now);
+	}
+
+	__atomic_store_n(&q->busy, 0, __ATOMIC_RELEASE);
+	return el;
+}
+
+
+/* Returns the sojourn time in ns under which at least <pct> percent of the
+ * elements which left codel queue <q> stayed, rounded up to the next power of
+ * two, or 0 if none left yet. Example:
+ *
+ *   p99 = mt_list_codel_percentile(&requests, 99.0);
+ */
+static inline uint64_t mt_list_codel_percentile(const struct mt_list_codel *q, double pct)
+{
+	uint64_t hist[MT_LIST_CODEL_BUCKETS], total = 0, cumul = 0;
+	unsigned int b;
+
+	for (b = 0; b < MT_LIST_CODEL_BUCKETS; b++) {
+		hist[b] = __atomic_load_n(&q->hist[b], __ATOMIC_RELAXED);
+		total += hist[b];
+	}
+	if (!total)
+		return 0;
+	for (b = 0; b < MT_LIST_CODEL_BUCKETS - 1; b++) {
+		cumul += hist[b];
+		if (cumul * 100.0 >= total * pct)
+			break;
+	}
+	return 2ULL << b;
+}
+
+
+/* Dumps the sojourn time histogram of codel queue <q> into <out>, one line
+ * per non-empty bucket, followed by the number of drops. Example:
+ *
+ *   mt_list_codel_dump(&requests, stderr);
+ */
+static inline void mt_list_codel_dump(const struct mt_list_codel *q, FILE *out)
+{
+	uint64_t n;
+	unsigned int b;
+
+	fprintf(out, "%14s %14s\n", "sojourn_ns<", "elements");
+	for (b = 0; b < MT_LIST_CODEL_BUCKETS; b++) {
+		n = __atomic_load_n(&q->hist[b], __ATOMIC_RELAXED);
+		if (n)
+			fprintf(out, "%14llu %14llu\n", 2ULL << b, (unsigned long long)n);
+	}
+	fprintf(out, "drops: %llu\n", (unsigned long long)__atomic_load_n(&q->drops, __ATOMIC_RELAXED));
+}
+
+#endif /* _MT_LIST_CODEL_H */
@@ -0,0 +1,222 @@
+/*
+ * include/mt_list_lazy.h
+ *
+ * Lazy deletion for multi-thread aware circular lists.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _MT_LIST_LAZY_H
+#define _MT_LIST_LAZY_H
+
+#include <mt_list.h>
+
+/* states of a lazy element */
+#define MT_LIST_LAZY_OUT   0   /* not in the list, or taken out of it */
+#define MT_LIST_LAZY_LIVE  1   /* in the list */
+#define MT_LIST_LAZY_DEAD  2   /* in the list but killed, to be reaped */
+
+/* An element of a lazy list. It must be embedded into the listed structure in
+ * place of a struct mt_list. Its state tells whether it was killed while in
+ * the list.
+ */
+struct mt_list_lazy_elem {
+	struct mt_list list;
+	unsigned int state;          /* MT_LIST_LAZY_* */
+};
+
+struct mt_list_lazy;
+
+/* called with each killed element once it is unlinked */
+typedef void (*mt_list_lazy_reap_cb)(struct mt_list_lazy *ll, struct mt_list_lazy_elem *el, void *ctx);
+
+/* A list supporting lazy deletion. mt_list_delete() needs to lock the element
+ * and both of its neighbours, which is expensive when they are hot (e.g. the
+ * list's head). Instead, mt_list_lazy_kill() only marks the element as dead
+ * with a single compare-and-swap on its state, without touching any link. Dead
+ * elements are then unlinked by whoever passes by: mt_list_lazy_pop() skips
+ * them, and mt_list_lazy_foreach() and mt_list_lazy_sweep() (e.g. called from
+ * a background task) remove them. Once unlinked, a dead element is passed to
+ * the reap callback, which may free it. The state decides between a killer
+ * and a popper racing for the same element: a killed element is never
+ * returned by a pop, and an element returned by a pop cannot be killed
+ * anymore. Since killing an element transfers its ownership to the list, the
+ * killer must not access it anymore.
+ */
+struct mt_list_lazy {
+	struct mt_list head;
+	mt_list_lazy_reap_cb reap;   /* must not be NULL */
+	void *ctx;                   /* passed to <reap> */
+};
+
+
+/* Returns a pointer of type <t> to the structure containing a member of type
+ * mt_list_lazy_elem called <m> that was popped from lazy list <ll>. If the
+ * list holds no live element, NULL is returned instead. Example:
+ *
+ *   while ((tmr = MT_LIST_LAZY_POP(&timers, struct timer *, lel))) ...
+ */
+#define MT_LIST_LAZY_POP(ll, t, m)					\
+	({								\
+		struct mt_list_lazy_elem *_e = mt_list_lazy_pop(ll);	\
+		(_e ? MT_LIST_ELEM(_e, t, m) : NULL);			\
+	})
+
+
+/* Initializes lazy list <ll> as empty. Killed elements will be passed to
+ * <reap> along with <ctx> once unlinked, with their list member either in
+ * detached form or still locked, so that it must be reinitialized before the
+ * element is reused. The callback must not perform any operation on the list.
+ * The list is returned.
+ */
+static inline struct mt_list_lazy *mt_list_lazy_init(struct mt_list_lazy *ll, mt_list_lazy_reap_cb reap, void *ctx)
+{
+	mt_list_init(&ll->head);
+	ll->reap = reap;
+	ll->ctx  = ctx;
+	return ll;
+}
+
+/* Initializes lazy element <el> as not part of any list, and returns it */
+static inline struct mt_list_lazy_elem *mt_list_lazy_elem_init(struct mt_list_lazy_elem *el)
+{
+	mt_list_init(&el->list);
+	el->state = MT_LIST_LAZY_OUT;
+	return el;
+}
+
+
+/* Appends or inserts element <el> into lazy list <ll>. The element must not be
+ * part of any list.
+ */
+static inline void mt_list_lazy_append(struct mt_list_lazy *ll, struct mt_list_lazy_elem *el)
+{
+	__atomic_store_n(&el->state, MT_LIST_LAZY_LIVE, __ATOMIC_RELAXED);
+	mt_list_append(&ll->head, &el->list);
+}
+
+static inline void mt_list_lazy_insert(struct mt_list_lazy *ll, struct mt_list_lazy_elem *el)
+{
+	__atomic_store_n(&el->state, MT_LIST_LAZY_LIVE, __ATOMIC_RELAXED);
+	mt_list_insert(&ll->head, &el->list);
+}
+
+
+/* Marks element <el> as dead, without locking anything. Returns non-zero if
+ * the element was live, in which case it now belongs to the list and will be
+ * reaped once unlinked, so that the caller must not access it anymore.
+ * Otherwise zero is returned because it was already killed, or was already
+ * popped (or never added), in which case it still belongs to whoever holds it.
+ */
+static inline long mt_list_lazy_kill(struct mt_list_lazy_elem *el)
+{
+	unsigned int old = MT_LIST_LAZY_LIVE;
+
+	return __atomic_compare_exchange_n(&el->state, &old, MT_LIST_LAZY_DEAD, 0,
+	                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* Returns non-zero if element <el> was killed. It may be used to skip dead
+ * elements when walking over a lazy list using the regular iterators.
+ */
+static inline long mt_list_lazy_isdead(const struct mt_list_lazy_elem *el)
+{
+	return __atomic_load_n(&el->state, __ATOMIC_ACQUIRE) == MT_LIST_LAZY_DEAD;
+}
+
+
+/* Removes the first live element of lazy list <ll> and returns it in detached
+ * form, or NULL if the list holds no live element. Dead elements found before
+ * it are unlinked and reaped.
+ */
+static MT_INLINE struct mt_list_lazy_elem *mt_list_lazy_pop(struct mt_list_lazy *ll)
+{
+	struct mt_list_lazy_elem *el;
+	struct mt_list *n;
+
+	while ((n = mt_list_pop(&ll->head))) {
+		el = MT_LIST_ELEM(n, struct mt_list_lazy_elem *, list);
+		if (__atomic_exchange_n(&el->state, MT_LIST_LAZY_OUT, __ATOMIC_ACQ_REL) != MT_LIST_LAZY_DEAD)
+			return el;
+		ll->reap(ll, el, ll->ctx);
+	}
+	return NULL;
+}
+
+
+/* context of mt_list_lazy_foreach() */
+struct _mt_list_lazy_walk {
+	struct mt_list_lazy *ll;
+	int (*cb)(struct mt_list_lazy_elem *el, void *ctx);
+	void *ctx;
+	unsigned int reaped;
+};
+
+/* mt_list_foreach() callback for mt_list_lazy_foreach() */
+static inline int _mt_list_lazy_visit(struct mt_list *n, void *arg)
+{
+	struct _mt_list_lazy_walk *walk = (struct _mt_list_lazy_walk *)arg;
+	struct mt_list_lazy_elem *el = MT_LIST_ELEM(n, struct mt_list_lazy_elem *, list);
+	int ret = MT_LIST_FE_CONT;
+
+	if (walk->cb && !mt_list_lazy_isdead(el))
+		ret = walk->cb(el, walk->ctx) & MT_LIST_FE_STOP;
+
+	/* the element may have been killed by the callback or another thread */
+	if (mt_list_lazy_isdead(el)) {
+		walk->ll->reap(walk->ll, el, walk->ll->ctx);
+		walk->reaped++;
+		ret |= MT_LIST_FE_REMOVE;
+	}
+	return ret;
+}
+
+/* Walks over lazy list <ll> using mt_list_foreach() with <flags>, and calls
+ * <cb> with <ctx> on each live element. Dead elements are unlinked and reaped
+ * on the way. The callback returns MT_LIST_FE_CONT or MT_LIST_FE_STOP, and
+ * removes the element by killing it with mt_list_lazy_kill(), in which case it
+ * is reaped immediately. The same restrictions as for mt_list_foreach() apply.
+ * The number of elements visited, dead or live, is returned.
+ */
+static inline unsigned int mt_list_lazy_foreach(struct mt_list_lazy *ll, int (*cb)(struct mt_list_lazy_elem *el, void *ctx),
+                                                void *ctx, unsigned int flags)
+{
+	struct _mt_list_lazy_walk walk = { ll, cb, ctx, 0 };
+
+	return mt_list_foreach(&ll->head, _mt_list_lazy_visit, &walk, flags);
+}
+
+/* Unlinks and reaps all dead elements of lazy list <ll>. It is meant to be
+ * called periodically (e.g. from a background task) on lists where dead
+ * elements would otherwise remain a long time, and only locks one element at
+ * a time. Returns the number of elements reaped.
+ */
+static inline unsigned int mt_list_lazy_sweep(struct mt_list_lazy *ll)
+{
+	struct _mt_list_lazy_walk walk = { ll, NULL, NULL, 0 };
+
+	mt_list_foreach(&ll->head, _mt_list_lazy_visit, &walk, 0);
+	return walk.reaped;
+}
+
+#endif /* _MT_LIST_LAZY_H */
@@ -0,0 +1,166 @@
+/*
+ * include/mt_list_mbox.h
+ *
+ * Multi-producer single-consumer mailboxes for multi-thread aware circular
+ * lists.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _MT_LIST_MBOX_H
+#define _MT_LIST_MBOX_H
+
+#include <mt_list.h>
+
+struct mt_list_mbox;
+
+/* called by the sender of a message which found the mailbox empty */
+typedef void (*mt_list_mbox_wake_cb)(struct mt_list_mbox *mb, void *ctx);
+
+/* A mailbox, owned by a single thread which receives messages sent by any
+ * number of threads, such as objects to be freed by the thread which
+ * allocated them. Senders append messages to a shared list. The owner takes
+ * them all at once using mt_list_behead(), which is safe since no message is
+ * ever deleted from the shared list, and moves them to a private queue from
+ * which it then receives them one at a time without any atomic operation.
+ * Messages are received in the order they were sent. The sender which finds
+ * the shared list empty wakes the owner up, so that the owner is notified at
+ * most once per batch of messages. The private queue is placed on a separate
+ * cache line from the shared part.
+ */
+struct mt_list_mbox {
+	struct mt_list head;          /* shared list, senders append here */
+	mt_list_mbox_wake_cb wake;    /* NULL=no notification */
+	void *ctx;                    /* passed to <wake> */
+
+	/* owner's private part */
+	struct mt_list queue __attribute__((aligned(64))); /* owned list of fetched messages */
+};
+
+
+/* Returns a pointer of type <t> to the structure containing a member of type
+ * mt_list called <m> that was received from mailbox <mb>. If no message is
+ * pending, NULL is returned instead. Example:
+ *
+ *   while ((obj = MT_LIST_MBOX_RECV(&mbox[tid], struct obj *, list))) ...
+ */
+#define MT_LIST_MBOX_RECV(mb, t, m)					\
+	({								\
+		struct mt_list *_n = mt_list_mbox_recv(mb);		\
+		(_n ? MT_LIST_ELEM(_n, t, m) : NULL);			\
+	})
+
+
+/* Initializes mailbox <mb> as empty. If <wake> is not NULL, it is called with
+ * <ctx> by the sender which finds the mailbox empty, typically to wake its
+ * owner up (e.g. by writing to an eventfd). The notification must be sticky,
+ * since it may happen between the owner's last receipt and the moment it
+ * starts to wait. The mailbox is returned.
+ */
+static inline struct mt_list_mbox *mt_list_mbox_init(struct mt_list_mbox *mb, mt_list_mbox_wake_cb wake, void *ctx)
+{
+	mt_list_init(&mb->head);
+	mt_list_init(&mb->queue);
+	mb->wake = wake;
+	mb->ctx  = ctx;
+	return mb;
+}
+
+
+/* Sends message <el> to mailbox <mb>, which may be done by any thread. The
+ * element must not be part of any list. If the mailbox was empty, its wake
+ * callback is called, if any, and non-zero is returned so that the caller may
+ * notify the owner by other means, otherwise zero is returned. Messages which
+ * were fetched but not yet received by the owner do not count.
+ */
+static inline long mt_list_mbox_send(struct mt_list_mbox *mb, struct mt_list *el)
+{
+	struct mt_list ends;
+	long first;
+
+	ends = mt_list_lock_prev(&mb->head);
+	first = ends.prev == &mb->head;
+
+	/* mt_list_unlock_full() would unlock the head first, letting the owner
+	 * behead the list while the previous message's next pointer is still
+	 * locked. As in mt_list_try_append(), the head is unlocked last.
+	 */
+	MT_LIST_HOLD_END(ends.prev);
+	el->next = ends.next;
+	el->prev = ends.prev;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	ends.prev->next = el;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	ends.next->prev = el;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (first && mb->wake)
+		mb->wake(mb, mb->ctx);
+	return first;
+}
+
+
+/* Moves all messages sent to mailbox <mb> to the end of its private queue,
+ * using a single mt_list_behead(). It may only be called by the mailbox's
+ * owner. Returns non-zero if at least one message was fetched, otherwise
+ * zero. The fetched messages may then be received with mt_list_mbox_recv(),
+ * or visited in order with MT_LIST_OWN_FOR_EACH_ENTRY_SAFE() on <mb>->queue.
+ */
+static inline long mt_list_mbox_fetch(struct mt_list_mbox *mb)
+{
+	struct mt_list *first, *last;
+
+	first = mt_list_behead(&mb->head);
+	if (!first)
+		return 0;
+
+	/* the chain is in sending order, <first>->prev is the last one and
+	 * its next is NULL.
+	 */
+	last = first->prev;
+	first->prev = mb->queue.prev;
+	mb->queue.prev->next = first;
+	last->next = &mb->queue;
+	mb->queue.prev = last;
+	return 1;
+}
+
+
+/* Receives the next message of mailbox <mb> and returns it in detached form,
+ * or NULL if no message is pending. Messages are taken from the private
+ * queue, which is refilled from the shared list once empty. It may only be
+ * called by the mailbox's owner.
+ */
+static inline struct mt_list *mt_list_mbox_recv(struct mt_list_mbox *mb)
+{
+	struct mt_list *n;
+
+	n = mt_list_own_pop(&mb->queue);
+	if (!n && mt_list_mbox_fetch(mb))
+		n = mt_list_own_pop(&mb->queue);
+	return n;
+}
+
+#endif /* _MT_LIST_MBOX_H */
@@ -0,0 +1,158 @@
+/*
+ * include/mt_list_mq.h
+ *
+ * Multi-queue consumer for multi-thread aware circular lists.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _MT_LIST_MQ_H
+#define _MT_LIST_MQ_H
+
+#include <mt_list.h>
+
+/* A multi-queue consumer. It pops elements from a set of list heads, which
+ * usually correspond to priority classes, index 0 being the highest priority.
+ * It is owned by a single consumer (typically one per thread), and only holds
+ * the consumer's private scheduling state, so that multiple consumers may
+ * share the same heads without sharing any counter. The heads and weights
+ * arrays are not copied and must remain valid as long as the consumer is
+ * used.
+ */
+struct mt_list_mq {
+	struct mt_list **heads;      /* array of <nbq> list heads */
+	const unsigned int *weights; /* array of <nbq> weights, NULL=strict prio */
+	unsigned int nbq;            /* number of queues */
+	unsigned int cur;            /* queue currently being served (WRR) */
+	unsigned int credit;         /* pops left on the current queue (WRR) */
+	unsigned int last;           /* queue the last element was popped from */
+};
+
+
+/* Returns a pointer of type <t> to the structure containing a member of type
+ * mt_list called <m> that was popped by multi-queue consumer <mq>. If all
+ * queues are empty, NULL is returned instead. This is only convenient when
+ * all queues carry the same type of elements, otherwise <mq>->last indicates
+ * the queue the element comes from. Example:
+ *
+ *   while ((task = MT_LIST_MQ_POP(&mq, struct task *, list))) ...
+ */
+#define MT_LIST_MQ_POP(mq, t, m)					\
+	({								\
+		struct mt_list *_n = mt_list_mq_pop(mq);		\
+		(_n ? MT_LIST_ELEM(_n, t, m) : NULL);			\
+	})
+
+
+/* Initializes multi-queue consumer <mq> to pop from the <nbq> list heads in
+ * array <heads>. If <weights> is NULL, the queues are served in strict
+ * priority order: an element is only taken from queue N when all queues
+ * before it are empty. Otherwise <weights> must contain <nbq> entries, and
+ * queues are served in weighted round-robin: up to weights[N] consecutive
+ * elements are taken from queue N before switching to the next one. A zero
+ * weight disables a queue. Empty queues are skipped and lose their remaining
+ * credit, so that no time is wasted waiting for them. The consumer is
+ * returned.
+ */
+static inline struct mt_list_mq *mt_list_mq_init(struct mt_list_mq *mq, struct mt_list **heads,
+                                                 const unsigned int *weights, unsigned int nbq)
+{
+	mq->heads   = heads;
+	mq->weights = weights;
+	mq->nbq     = nbq;
+	mq->cur     = 0;
+	mq->credit  = weights && nbq ? weights[0] : 0;
+	mq->last    = 0;
+	return mq;
+}
+
+
+/* Returns true if list head <lh> looks empty. This only performs a read so
+ * that idle queues are checked without stealing their cache line from the
+ * producers. The result is only a hint since the list may change right after,
+ * and a locked head is reported as non-empty.
+ */
+static inline long _mt_list_mq_looks_empty(struct mt_list *lh)
+{
+	return __atomic_load_n(&lh->next, __ATOMIC_RELAXED) == lh;
+}
+
+
+/* Pops one element from the queues of multi-queue consumer <mq> according to
+ * its scheduling policy (see mt_list_mq_init()), and returns it in detached
+ * form. The index of the queue it was taken from is stored into <mq>->last.
+ * If all queues are empty, NULL is returned instead. Queues which look empty
+ * are skipped using read-only checks, and only non-empty ones are passed to
+ * mt_list_pop().
+ */
+static MT_INLINE struct mt_list *mt_list_mq_pop(struct mt_list_mq *mq)
+{
+	struct mt_list *n;
+	unsigned int q;
+	unsigned int tries;
+
+	if (!mq->nbq)
+		return NULL;
+
+	if (!mq->weights) {
+		/* strict priority */
+		for (q = 0; q < mq->nbq; q++) {
+			if (_mt_list_mq_looks_empty(mq->heads[q]))
+				continue;
+			n = mt_list_pop(mq->heads[q]);
+			if (n) {
+				mq->last = q;
+				return n;
+			}
+		}
+		return NULL;
+	}
+
+	/* weighted round-robin: we may have to visit the current queue twice
+	 * if it was the only non-empty one and had no credit left.
+	 */
+	for (tries = 0; tries <= mq->nbq; tries++) {
+		if (!mq->credit) {
+			if (++mq->cur >= mq->nbq)
+				mq->cur = 0;
+			mq->credit = mq->weights[mq->cur];
+			if (!mq->credit)
+				continue;
+		}
+
+		q = mq->cur;
+		if (!_mt_list_mq_looks_empty(mq->heads[q])) {
+			n = mt_list_pop(mq->heads[q]);
+			if (n) {
+				mq->credit--;
+				mq->last = q;
+				return n;
+			}
+		}
+		/* empty queue, forfeit its credit */
+		mq->credit = 0;
+	}
+	return NULL;
+}
+
+#endif /* _MT_LIST_MQ_H */
@@ -0,0 +1,376 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mt_list.h>
+#include "bench.h"
+
+/* Iterator convoy benchmark for mt_lists. Compile this way:
+ *    cc -O2 -o bench-convoy bench-convoy.c -I../include -pthread -lm
+ * It takes comma-separated lists of list lengths and of numbers of scanners,
+ * the number of mutator threads, and optionally the duration of each run in
+ * seconds (default 2) and the iterator to use, "locked" (default) or
+ * "unlocked":
+ * ./bench-convoy 10,1000,100000,10000000 1,2,4,8 2 2 locked
+ *
+ * For each combination of length and number of scanners, the scanners
+ * continuously walk the list using MT_LIST_FOR_EACH_ENTRY_LOCKED() (or
+ * _UNLOCKED()), while the mutators append, pop and delete random elements
+ * taken from a pool twice as large as the list. The operation mix (60%
+ * appends, 20% pops, 20% deletes) keeps the list around its initial length.
+ * With the unlocked iterator, elements must not be accessed other than through
+ * the list, so that the mutators only pop elements into a private stash and
+ * append them back from there, in equal proportions.
+ *
+ * Since a scanner cannot pass another one, scanners which catch up with a
+ * slower one end up walking behind it, one element apart: they form a convoy.
+ * The main thread samples the position of each scanner in its current scan
+ * every millisecond and computes the distances between consecutive scanners
+ * (modulo the list's length). It reports the average smallest distance as a
+ * percentage of the ideal one (length / scanners), and the share of samples
+ * where two scanners were adjacent. Scanners are reported with their number
+ * of scans and elements visited per second, and mutators with the latency
+ * distribution of each operation. When BENCH_SERIES is set to a number of
+ * milliseconds, the distances between scanners are also printed over time at
+ * this interval. All the combinations are run for each placement listed in
+ * BENCH_PLACE (see bench.h).
+ */
+
+#define OP_APPEND  0
+#define OP_POP     1
+#define OP_DELETE  2
+#define OP_TYPES   3
+
+static const char *op_names[OP_TYPES] = {
+	"append", "pop", "delete",
+};
+
+struct elem {
+	struct mt_list list;
+	unsigned long value;
+};
+
+struct scanner {
+	pthread_t thr;
+	int cpu;
+	unsigned long pos;       /* position in the current scan */
+	uint64_t scans;
+	uint64_t visited;
+} __attribute__((aligned(64)));
+
+/* number of elements a mutator may keep aside with the unlocked iterator */
+#define STASH_SIZE 64
+
+struct mutator {
+	pthread_t thr;
+	int cpu;
+	unsigned int id;
+	unsigned int stashed;
+	struct mt_list *stash[STASH_SIZE];
+	uint64_t ops[OP_TYPES];
+	uint64_t lat[OP_TYPES][BENCH_LAT_BUCKETS];
+	uint64_t lat_max[OP_TYPES];
+} __attribute__((aligned(64)));
+
+static struct mt_list head = MT_LIST_HEAD_INIT(head);
+static struct elem *pool;
+static unsigned long pool_size;
+static int unlocked;
+
+static volatile int start_flag, stop_flag;
+
+/* keeps the sum of the values so that the scans are not optimized away */
+static volatile unsigned long sink;
+
+void *scan_thread(void *arg)
+{
+	struct scanner *sc = arg;
+	struct mt_list back;
+	struct elem *item;
+	unsigned long pos, sum = 0;
+
+	bench_pin(sc->cpu);
+	while (!start_flag)
+		mt_list_cpu_relax1();
+
+	while (!stop_flag) {
+		pos = 0;
+		if (unlocked) {
+			MT_LIST_FOR_EACH_ENTRY_UNLOCKED(item, &head, list, back) {
+				sum += item->value;
+				__atomic_store_n(&sc->pos, ++pos, __ATOMIC_RELAXED);
+				if (!(pos & 1023) && stop_flag)
+					break;
+			}
+		} else {
+			MT_LIST_FOR_EACH_ENTRY_LOCKED(item, &head, list, back) {
+				sum += item->value;
+				__atomic_store_n(&sc->pos, ++pos, __ATOMIC_RELAXED);
+				if (!(pos & 1023) && stop_flag)
+					break;
+			}
+		}
+		__atomic_store_n(&sc->pos, 0, __ATOMIC_RELAXED);
+		sc->visited += pos;
+		sc->scans += !stop_flag;
+	}
+	sink += sum;
+	return NULL;
+}
+
+void *mutate_thread(void *arg)
+{
+	struct mutator *mu = arg;
+	uint32_t rnd = 2463534242U + mu->id * 0x9E3779B9U;
+	struct elem *el;
+	uint64_t t0, lat;
+	unsigned int op;
+
+	bench_pin(mu->cpu);
+	while (!start_flag)
+		mt_list_cpu_relax1();
+
+	while (!stop_flag) {
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+
+		el = &pool[(rnd >> 8) % pool_size];
+		if (!unlocked)
+			op = rnd % 5 < 3 ? OP_APPEND : rnd % 5 == 3 ? OP_POP : OP_DELETE;
+		else if (mu->stashed && (mu->stashed == STASH_SIZE || rnd % 2))
+			op = OP_APPEND;
+		else
+			op = OP_POP;
+
+		t0 = bench_now_ns();
+		switch (op) {
+		case OP_APPEND:
+			if (unlocked)
+				mt_list_append(&head, mu->stash[--mu->stashed]);
+			else
+				mt_list_try_append(&head, &el->list);
+			break;
+		case OP_POP:
+			if ((mu->stash[mu->stashed] = mt_list_pop(&head)) && unlocked)
+				mu->stashed++;
+			break;
+		case OP_DELETE:
+			mt_list_delete(&el->list);
+			break;
+		}
+		lat = bench_now_ns() - t0;
+
+		mu->ops[op]++;
+		mu->lat[op][bench_lat_bucket(lat)]++;
+		if (lat > mu->lat_max[op])
+			mu->lat_max[op] = lat;
+	}
+	return NULL;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	const unsigned long *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/* Runs one measurement of <secs> seconds with a list of <len> elements,
+ * <nb_scan> scanners and <nb_mut> mutators, and reports it.
+ */
+static void run(unsigned long len, unsigned int nb_scan, unsigned int nb_mut, unsigned int secs, int place)
+{
+	struct scanner *sc;
+	struct mutator *mu;
+	struct mutator total;
+	unsigned long *pos, gap, min_gap, i;
+	uint64_t t0, now, duration, next_series = 0;
+	uint64_t samples = 0, adjacent = 0;
+	double gap_sum = 0, ideal, rate, rate_min = 0, rate_max = 0, rate_sum = 0;
+	unsigned int series = getenv("BENCH_SERIES") ? atoi(getenv("BENCH_SERIES")) : 0;
+	unsigned int t, op, b;
+	int cpus[nb_scan + nb_mut];
+	long dist;
+	int print;
+
+	/* the list starts with the first <len> elements of the pool */
+	pool_size = len * 2;
+	pool = calloc(pool_size, sizeof(*pool));
+	sc = calloc(nb_scan, sizeof(*sc));
+	mu = calloc(nb_mut, sizeof(*mu));
+	pos = calloc(nb_scan, sizeof(*pos));
+	if (!pool || !sc || !mu || !pos) {
+		printf("Out of memory.\n");
+		exit(1);
+	}
+	mt_list_init(&head);
+	for (i = 0; i < pool_size; i++) {
+		pool[i].value = i + 1;
+		mt_list_init(&pool[i].list);
+		if (i < len)
+			mt_list_append(&head, &pool[i].list);
+	}
+
+	bench_place_cpus(place, cpus, nb_scan + nb_mut);
+	start_flag = stop_flag = 0;
+	for (t = 0; t < nb_scan; t++) {
+		sc[t].cpu = cpus[t];
+		if (pthread_create(&sc[t].thr, NULL, scan_thread, &sc[t]) != 0)
+			goto fail;
+	}
+	for (t = 0; t < nb_mut; t++) {
+		mu[t].cpu = cpus[nb_scan + t];
+		mu[t].id = t;
+		if (pthread_create(&mu[t].thr, NULL, mutate_thread, &mu[t]) != 0)
+			goto fail;
+	}
+
+	ideal = (double)len / nb_scan;
+	t0 = now = bench_now_ns();
+	start_flag = 1;
+	while (now - t0 < secs * 1000000000ULL) {
+		usleep(1000);
+		now = bench_now_ns();
+		if (nb_scan < 2)
+			continue;
+
+		/* distances between consecutive scanners, the last one being
+		 * followed by the first one in the next scan.
+		 */
+		for (t = 0; t < nb_scan; t++)
+			pos[t] = __atomic_load_n(&sc[t].pos, __ATOMIC_RELAXED);
+		qsort(pos, nb_scan, sizeof(*pos), cmp_ulong);
+
+		print = series && now >= next_series;
+		if (print) {
+			next_series = now + series * 1000000ULL;
+			printf("  %8.1f ms gaps:", (now - t0) / 1e6);
+		}
+		for (t = 0, min_gap = ~0UL; t < nb_scan; t++) {
+			/* the length varies a little, positions may exceed it */
+			dist = t < nb_scan - 1 ? (long)(pos[t + 1] - pos[t]) : (long)(pos[0] + len - pos[t]);
+			gap = dist > 0 ? dist : 0;
+			if (gap < min_gap)
+				min_gap = gap;
+			if (print)
+				printf(" %lu", gap);
+		}
+		if (print)
+			printf("\n");
+		samples++;
+		gap_sum += min_gap;
+		adjacent += min_gap <= 1;
+	}
+	stop_flag = 1;
+	for (t = 0; t < nb_scan; t++)
+		pthread_join(sc[t].thr, NULL);
+	for (t = 0; t < nb_mut; t++)
+		pthread_join(mu[t].thr, NULL);
+	duration = bench_now_ns() - t0;
+
+	for (t = 0; t < nb_scan; t++) {
+		rate = sc[t].scans * 1e9 / duration;
+		rate_sum += rate;
+		if (!t || rate < rate_min)
+			rate_min = rate;
+		if (!t || rate > rate_max)
+			rate_max = rate;
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (t = 0; t < nb_mut; t++) {
+		for (op = 0; op < OP_TYPES; op++) {
+			total.ops[op] += mu[t].ops[op];
+			for (b = 0; b < BENCH_LAT_BUCKETS; b++)
+				total.lat[op][b] += mu[t].lat[op][b];
+			if (mu[t].lat_max[op] > total.lat_max[op])
+				total.lat_max[op] = mu[t].lat_max[op];
+		}
+	}
+
+	printf("placement %s, length %lu, %u scanners, %u mutators:\n",
+	       bench_place_names[place], len, nb_scan, nb_mut);
+	if (nb_scan) {
+		uint64_t visited = 0;
+
+		for (t = 0; t < nb_scan; t++)
+			visited += sc[t].visited;
+		printf("  scans/s per scanner: min %.1f avg %.1f max %.1f, %.0f elements/s per scanner\n",
+		       rate_min, rate_sum / nb_scan, rate_max, visited * 1e9 / duration / nb_scan);
+	}
+	if (samples)
+		printf("  smallest distance: %.1f%% of ideal on average, scanners adjacent in %.1f%% of samples\n",
+		       gap_sum * 100.0 / samples / ideal, adjacent * 100.0 / samples);
+	for (op = 0; op < OP_TYPES; op++) {
+		if (!total.ops[op])
+			continue;
+		printf("  %-8s %10.0f ops/s  p50 %6llu  p99 %8llu  p999 %8llu  max %10llu ns\n", op_names[op],
+		       total.ops[op] * 1e9 / duration,
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 50),
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 99),
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 99.9),
+		       (unsigned long long)total.lat_max[op]);
+	}
+
+	free(pool);
+	free(sc);
+	free(mu);
+	free(pos);
+	return;
+ fail:
+	printf("Failed to create thread.\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *lens, *scans, *places, *p, *q;
+	unsigned int nb_mut, secs = 2, nb_scan, nb_places = 0, i;
+	unsigned long len;
+	int place[BENCH_MAX_PLACES];
+
+	if (argc < 4) {
+		printf("Usage: %s <lengths> <scanners> <mutators> [<seconds> [locked|unlocked]]\n", argv[0]);
+		exit(1);
+	}
+	lens = argv[1];
+	scans = argv[2];
+	nb_mut = atoi(argv[3]);
+	if (argc > 4)
+		secs = atoi(argv[4]);
+	if (argc > 5)
+		unlocked = strcmp(argv[5], "unlocked") == 0;
+
+	places = p = bench_place_list();
+	while ((place[nb_places] = bench_place_next(&p)) != -2) {
+		if (place[nb_places] < 0) {
+			printf("Unknown placement in '%s'.\n", places);
+			exit(1);
+		}
+		if (++nb_places == BENCH_MAX_PLACES)
+			break;
+	}
+	if (!bench_topo_load() && (nb_places > 1 || place[0] > 0)) {
+		printf("CPU topology not available, cannot place threads.\n");
+		exit(1);
+	}
+
+	printf("iterator: %s, %u s per run\n", unlocked ? "unlocked" : "locked", secs);
+	for (i = 0; i < nb_places; i++) {
+		for (p = lens; *p; p += strcspn(p, ",") + !!p[strcspn(p, ",")]) {
+			len = strtoul(p, NULL, 10);
+			if (!len) {
+				printf("Invalid length.\n");
+				exit(1);
+			}
+			for (q = scans; *q; q += strcspn(q, ",") + !!q[strcspn(q, ",")]) {
+				nb_scan = atoi(q);
+				run(len, nb_scan, nb_mut, secs, place[i]);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,224 @@
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mt_list.hpp>
+#include "bench.h"
+
+/* Benchmark of mt::list<T> against std::list<T> protected by a std::mutex.
+ * Compile this way:
+ *    c++ -O2 -std=c++17 -o bench-cxxlist bench-cxxlist.cc -I../include -pthread
+ * It optionally takes the number of threads (default 4), the duration of each
+ * run in seconds (default 2) and the number of values initially in the list
+ * (default 1000):
+ * ./bench-cxxlist 4 2 1000
+ *
+ * Two workloads are run on each container: "mixed", where each thread appends
+ * a value then pops the first one, and "split", where half of the threads only
+ * append and the other half only pop, so that values (and the pool's nodes)
+ * are released by other threads than the ones which allocated them. In the
+ * split workload the producers pause while the list holds more than twice the
+ * initial number of values. The values are of a move-only type. For each run,
+ * the rate of operations and the number of memory allocations performed during
+ * the measurement are reported.
+ */
+
+/* a move-only value */
+struct value {
+	uint64_t a, b;
+
+	value(uint64_t a, uint64_t b) : a(a), b(b) { }
+	value(value &&other) = default;
+	value(const value &) = delete;
+	value &operator=(value &&other) = default;
+	value &operator=(const value &) = delete;
+};
+
+/* allocations are counted while <counting> is set */
+static std::atomic<uint64_t> allocs;
+static volatile int counting;
+
+void *operator new(size_t size)
+{
+	void *ptr;
+
+	if (counting)
+		allocs.fetch_add(1, std::memory_order_relaxed);
+	ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void *operator new(size_t size, std::align_val_t align)
+{
+	void *ptr;
+
+	if (counting)
+		allocs.fetch_add(1, std::memory_order_relaxed);
+	if (posix_memalign(&ptr, (size_t)align < sizeof(void *) ? sizeof(void *) : (size_t)align, size ? size : 1))
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept                         { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept                 { free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept       { free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+
+/* the std::list baseline, with the same interface as mt::list */
+class locked_list {
+	std::list<value> l;
+	std::mutex lock;
+public:
+	void push_back(value &&v)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		l.push_back(std::move(v));
+	}
+
+	std::optional<value> pop_front()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (l.empty())
+			return std::nullopt;
+		std::optional<value> ret(std::move(l.front()));
+		l.pop_front();
+		return ret;
+	}
+};
+
+static volatile int start_flag, stop_flag;
+static std::atomic<long> length;  /* for the split workload */
+static long max_length;
+
+struct thread_ctx {
+	pthread_t thr;
+	unsigned int id;
+	int role;          /* 0=mixed, 1=producer, 2=consumer */
+	void *list;
+	uint64_t ops;
+} __attribute__((aligned(64)));
+
+template <typename L>
+void *thread(void *arg)
+{
+	struct thread_ctx *ctx = (struct thread_ctx *)arg;
+	L *l = (L *)ctx->list;
+	uint64_t ops = 0;
+
+	while (!start_flag)
+		mt_list_cpu_relax1();
+
+	while (!stop_flag) {
+		switch (ctx->role) {
+		case 0:
+			l->push_back(value(ctx->id, ops));
+			l->pop_front();
+			ops += 2;
+			break;
+		case 1:
+			if (length.load(std::memory_order_relaxed) >= max_length) {
+				mt_list_cpu_relax1();
+				break;
+			}
+			l->push_back(value(ctx->id, ops));
+			length.fetch_add(1, std::memory_order_relaxed);
+			ops++;
+			break;
+		case 2:
+			if (l->pop_front()) {
+				length.fetch_sub(1, std::memory_order_relaxed);
+				ops++;
+			}
+			break;
+		}
+	}
+	ctx->ops = ops;
+	return NULL;
+}
+
+/* runs the <split> or mixed workload on a list of type L with <nb> threads for
+ * <secs> seconds, starting with <init> values.
+ */
+template <typename L>
+static void run(const char *name, int split, unsigned int nb, unsigned int secs, unsigned int init)
+{
+	struct thread_ctx *ctx;
+	uint64_t t0, duration, ops = 0, nballocs;
+	unsigned int i, t;
+	L list, *l = &list;
+
+	ctx = (struct thread_ctx *)calloc(nb, sizeof(*ctx));
+	if (!ctx) {
+		printf("Out of memory.\n");
+		exit(1);
+	}
+
+	for (i = 0; i < init; i++)
+		l->push_back(value(0, i));
+	length = init;
+	max_length = 2 * (long)init + 1;
+
+	start_flag = stop_flag = 0;
+	for (t = 0; t < nb; t++) {
+		ctx[t].id = t;
+		ctx[t].role = split ? 1 + (t & 1) : 0;
+		ctx[t].list = l;
+		if (pthread_create(&ctx[t].thr, NULL, thread<L>, &ctx[t]) != 0) {
+			printf("Failed to create thread %u.\n", t);
+			exit(1);
+		}
+	}
+
+	/* let the lists and pools reach their steady state first */
+	start_flag = 1;
+	usleep(100000);
+	allocs = 0;
+	counting = 1;
+	t0 = bench_now_ns();
+	sleep(secs);
+	stop_flag = 1;
+	duration = bench_now_ns() - t0;
+	counting = 0;
+	nballocs = allocs;
+	for (t = 0; t < nb; t++) {
+		pthread_join(ctx[t].thr, NULL);
+		ops += ctx[t].ops;
+	}
+
+	printf("%-8s %-6s %14.0f %12llu %12.6f\n", name, split ? "split" : "mixed",
+	       ops * 1e9 / duration, (unsigned long long)nballocs, ops ? (double)nballocs / ops : 0.0);
+	free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nb = 4, secs = 2, init = 1000;
+
+	if (argc > 1)
+		nb = atoi(argv[1]);
+	if (argc > 2)
+		secs = atoi(argv[2]);
+	if (argc > 3)
+		init = atoi(argv[3]);
+	if (!nb) {
+		printf("Usage: %s [<threads> [<seconds> [<values>]]]\n", argv[0]);
+		exit(1);
+	}
+
+	printf("%u threads, %u s per run, %u values\n", nb, secs, init);
+	printf("%-8s %-6s %14s %12s %12s\n", "list", "load", "ops/s", "allocs", "allocs/op");
+	run<locked_list>("std", 0, nb, secs, init);
+	run<mt::list<value>>("mt", 0, nb, secs, init);
+	if (nb >= 2) {
+		run<locked_list>("std", 1, nb, secs, init);
+		run<mt::list<value>>("mt", 1, nb, secs, init);
+	}
+	return 0;
+}
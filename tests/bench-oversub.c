@@ -0,0 +1,270 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mt_list.h>
+#include "bench.h"
+
+/* Oversubscription benchmark for mt_lists. Compile this way:
+ *    cc -O2 -o bench-oversub bench-oversub.c -I../include -pthread -lm
+ * It optionally takes a comma-separated list of oversubscription factors
+ * (default 1,2,4,8), the duration of each run in seconds (default 2) and a CPU
+ * quota in the form <percent>:<period_ms> (default none):
+ * ./bench-oversub 1,2,4,8 2 50:100
+ *
+ * For each factor F, F threads per online CPU run a random mix of insert,
+ * append, pop, delete and short walks (up to 16 elements) on a few shared
+ * lists, each thread using its own elements. Threads which are preempted
+ * while holding a lock make the other ones spin, which is what makes the
+ * latency explode when there are more threads than CPUs. The latency
+ * distribution of each operation type is reported for each factor.
+ *
+ * The quota emulates a cgroup CPU quota: the whole group of threads runs
+ * during the first <percent> of each period, then all threads are throttled
+ * until the next period. Threads check the quota between operations and, when
+ * built with -DMT_LIST_DELAY, also inside the critical sections through the
+ * delay injection hook, so that threads may be throttled while holding locks,
+ * as happens with real quotas. BENCH_DELAY is not supported in this case.
+ */
+
+#define NB_LISTS     4
+#define THREAD_ELEMS 64
+#define WALK_MAX     16
+
+#define OP_INSERT  0
+#define OP_APPEND  1
+#define OP_POP     2
+#define OP_DELETE  3
+#define OP_WALK    4
+#define OP_TYPES   5
+
+static const char *op_names[OP_TYPES] = {
+	"insert", "append", "pop", "delete", "walk",
+};
+
+struct elem {
+	struct mt_list list;
+};
+
+struct thread_ctx {
+	pthread_t thr;
+	unsigned int id;
+	struct elem elems[THREAD_ELEMS];
+	uint64_t ops[OP_TYPES];
+	uint64_t lat[OP_TYPES][BENCH_LAT_BUCKETS];
+	uint64_t lat_max[OP_TYPES];
+} __attribute__((aligned(64)));
+
+static struct mt_list lists[NB_LISTS];
+static volatile int start_flag, stop_flag;
+
+/* CPU quota, none when quota_pct is zero */
+static unsigned int quota_pct;
+static uint64_t quota_period;   /* ns */
+static uint64_t quota_origin;   /* ns */
+
+/* Sleeps until the end of the current throttling window if the quota of the
+ * current period is exhausted.
+ */
+static void quota_check()
+{
+	struct timespec ts;
+	uint64_t now, pos;
+
+	if (!quota_pct)
+		return;
+	now = bench_now_ns();
+	pos = (now - quota_origin) % quota_period;
+	if (pos < quota_period * quota_pct / 100)
+		return;
+	pos = quota_period - pos;
+	ts.tv_sec  = pos / 1000000000ULL;
+	ts.tv_nsec = pos % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+#if defined(MT_LIST_DELAY)
+static void quota_hook(unsigned int op)
+{
+	quota_check();
+}
+#endif
+
+void *thread(void *arg)
+{
+	struct thread_ctx *ctx = arg;
+	uint32_t rnd = 2463534242U + ctx->id * 0x9E3779B9U;
+	struct mt_list *lh, back;
+	struct elem *el, *item;
+	unsigned int op, n;
+	uint64_t t0, lat;
+
+	while (!start_flag)
+		mt_list_cpu_relax1();
+
+	while (!stop_flag) {
+		quota_check();
+
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+
+		op = rnd % OP_TYPES;
+		lh = &lists[(rnd >> 8) % NB_LISTS];
+		el = &ctx->elems[(rnd >> 16) % THREAD_ELEMS];
+
+		t0 = bench_now_ns();
+		switch (op) {
+		case OP_INSERT:
+			mt_list_try_insert(lh, &el->list);
+			break;
+		case OP_APPEND:
+			mt_list_try_append(lh, &el->list);
+			break;
+		case OP_POP:
+			mt_list_pop(lh);
+			break;
+		case OP_DELETE:
+			mt_list_delete(&el->list);
+			break;
+		case OP_WALK:
+			n = 0;
+			MT_LIST_FOR_EACH_ENTRY_LOCKED(item, lh, list, back) {
+				if (++n == WALK_MAX)
+					break;
+			}
+			break;
+		}
+		lat = bench_now_ns() - t0;
+
+		ctx->ops[op]++;
+		ctx->lat[op][bench_lat_bucket(lat)]++;
+		if (lat > ctx->lat_max[op])
+			ctx->lat_max[op] = lat;
+	}
+	return NULL;
+}
+
+/* runs <nb> threads for <secs> seconds and reports the latencies */
+static void run(unsigned int factor, unsigned int nb, unsigned int secs)
+{
+	struct thread_ctx *ctx, total;
+	uint64_t t0, duration, all = 0;
+	unsigned int i, t, op, b;
+
+	ctx = calloc(nb, sizeof(*ctx));
+	if (!ctx) {
+		printf("Out of memory.\n");
+		exit(1);
+	}
+	for (i = 0; i < NB_LISTS; i++)
+		mt_list_init(&lists[i]);
+
+	start_flag = stop_flag = 0;
+	for (t = 0; t < nb; t++) {
+		ctx[t].id = t;
+		for (i = 0; i < THREAD_ELEMS; i++)
+			mt_list_init(&ctx[t].elems[i].list);
+		if (pthread_create(&ctx[t].thr, NULL, thread, &ctx[t]) != 0) {
+			printf("Failed to create thread %u.\n", t);
+			exit(1);
+		}
+	}
+
+	t0 = quota_origin = bench_now_ns();
+	start_flag = 1;
+	sleep(secs);
+	stop_flag = 1;
+	for (t = 0; t < nb; t++)
+		pthread_join(ctx[t].thr, NULL);
+	duration = bench_now_ns() - t0;
+
+	memset(&total, 0, sizeof(total));
+	for (t = 0; t < nb; t++) {
+		for (op = 0; op < OP_TYPES; op++) {
+			total.ops[op] += ctx[t].ops[op];
+			for (b = 0; b < BENCH_LAT_BUCKETS; b++)
+				total.lat[op][b] += ctx[t].lat[op][b];
+			if (ctx[t].lat_max[op] > total.lat_max[op])
+				total.lat_max[op] = ctx[t].lat_max[op];
+		}
+	}
+
+	printf("\n%ux: %u threads\n%-8s %12s %8s %10s %10s %12s\n", factor, nb,
+	       "op", "ops/s", "p50_ns", "p99_ns", "p999_ns", "max_ns");
+	for (op = 0; op < OP_TYPES; op++) {
+		if (!total.ops[op])
+			continue;
+		all += total.ops[op];
+		printf("%-8s %12.0f %8llu %10llu %10llu %12llu\n", op_names[op],
+		       total.ops[op] * 1e9 / duration,
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 50),
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 99),
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 99.9),
+		       (unsigned long long)total.lat_max[op]);
+	}
+	printf("total    %12.0f\n", all * 1e9 / duration);
+
+	/* drain the lists before freeing the elements */
+	for (i = 0; i < NB_LISTS; i++)
+		while (mt_list_pop(&lists[i]))
+			;
+	free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *factors = "1,2,4,8", *p;
+	unsigned int secs = 2, factor, period_ms = 0;
+	long cpus;
+
+	if (argc > 1)
+		factors = argv[1];
+	if (argc > 2)
+		secs = atoi(argv[2]);
+	if (argc > 3 && (sscanf(argv[3], "%u:%u", &quota_pct, &period_ms) != 2 ||
+	                 !quota_pct || quota_pct > 100 || !period_ms)) {
+		printf("Usage: %s [<factors> [<seconds> [<percent>:<period_ms>]]]\n", argv[0]);
+		exit(1);
+	}
+	quota_period = period_ms * 1000000ULL;
+
+	if (bench_delay_init() < 0)
+		exit(1);
+#if defined(MT_LIST_DELAY)
+	if (quota_pct) {
+		if (mt_list_delay_hook) {
+			printf("BENCH_DELAY cannot be combined with a quota.\n");
+			exit(1);
+		}
+		mt_list_delay_hook = quota_hook;
+	}
+#endif
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+
+	printf("%ld CPUs, %u s per run", cpus, secs);
+	if (quota_pct)
+		printf(", quota %u%% of %u ms%s", quota_pct, period_ms,
+#if defined(MT_LIST_DELAY)
+		       " (also inside critical sections)"
+#else
+		       ""
+#endif
+		       );
+	printf("\n");
+
+	for (p = factors; *p; p += strcspn(p, ",") + !!p[strcspn(p, ",")]) {
+		factor = atoi(p);
+		if (!factor) {
+			printf("Invalid factor.\n");
+			exit(1);
+		}
+		run(factor, factor * cpus, secs);
+	}
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <mt_list.h>
+#include "bench.h"
+
+/* Scan benchmark for mt_list_relink(). Compile this way:
+ *    cc -O2 -o bench-relink bench-relink.c -I../include
+ * It takes the number of elements and the relinking window as optional
+ * arguments (default 65536 and 256):
+ * ./bench-relink 262144 256
+ *
+ * The elements are allocated contiguously then linked in random order, and
+ * the list is scanned before relinking, after a single relinking pass, and
+ * after relinking until the list is fully ordered by address. When BENCH_PERF
+ * is set in the environment, hardware counters are reported for each scan,
+ * normalized per element (see bench.h).
+ */
+
+struct mt_list bench_list = MT_LIST_HEAD_INIT(bench_list);
+
+/* one element per cache line, as is commonly the case with pools */
+struct bench_elt {
+	struct mt_list list_elt;
+	unsigned long value;
+	char pad[40];
+};
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct bench_perf perf;
+
+/* scans the list <rounds> times and returns the average time per element in
+ * nanoseconds. The counters are stored into <cnt>. The sum is only printed so
+ * that the scan is not optimized away.
+ */
+static double scan(unsigned int nb, unsigned int rounds, struct bench_counters *cnt)
+{
+	struct bench_elt *elt;
+	unsigned long sum = 0;
+	unsigned int r;
+	double start;
+
+	memset(cnt, 0, sizeof(*cnt));
+	start = now();
+	bench_perf_start(&perf);
+	for (r = 0; r < rounds; r++) {
+		MT_LIST_OWN_FOR_EACH_ENTRY(elt, &bench_list, list_elt)
+			sum += elt->value;
+	}
+	bench_perf_stop(&perf, cnt);
+	if (!sum)
+		printf("empty sum!\n");
+	return (now() - start) * 1e9 / ((double)nb * rounds);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_elt *tab;
+	unsigned int *order;
+	unsigned int nb = 65536, window = 256;
+	unsigned int i, j, tmp, passes, moved, rounds;
+	struct bench_counters cnt;
+	double start, duration;
+
+	if (argc > 1)
+		nb = atoi(argv[1]);
+	if (argc > 2)
+		window = atoi(argv[2]);
+	if (nb < 2) {
+		printf("Usage: %s [<nb_elements> [<window>]]\n", argv[0]);
+		exit(1);
+	}
+
+	tab = calloc(nb, sizeof(*tab));
+	order = malloc(nb * sizeof(*order));
+	if (!tab || !order) {
+		printf("Out of memory.\n");
+		exit(1);
+	}
+
+	/* shuffle the insertion order */
+	srandom(1);
+	for (i = 0; i < nb; i++)
+		order[i] = i;
+	for (i = nb - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+	}
+
+	for (i = 0; i < nb; i++) {
+		tab[order[i]].value = i + 1;
+		mt_list_append(&bench_list, &tab[order[i]].list_elt);
+	}
+
+	/* about 100M elements visited per measurement */
+	rounds = 100000000 / nb + 1;
+
+	bench_perf_init(&perf);
+	printf("elements: %u, window: %u, rounds: %u\n", nb, window, rounds);
+	printf("random order:   %7.3f ns/elt\n", scan(nb, rounds, &cnt));
+	bench_counters_print("  counters", &cnt, (uint64_t)nb * rounds);
+
+	start = now();
+	moved = mt_list_relink(&bench_list, window);
+	duration = now() - start;
+	printf("after 1 pass:   %7.3f ns/elt (%u moved in %.3f ms)\n",
+	       scan(nb, rounds, &cnt), moved, duration * 1e3);
+	bench_counters_print("  counters", &cnt, (uint64_t)nb * rounds);
+
+	start = now();
+	for (passes = 1; mt_list_relink(&bench_list, window); passes++)
+		;
+	duration = now() - start;
+	printf("address order:  %7.3f ns/elt (%u more passes in %.3f s)\n",
+	       scan(nb, rounds, &cnt), passes, duration);
+	bench_counters_print("  counters", &cnt, (uint64_t)nb * rounds);
+	bench_perf_close(&perf);
+	return 0;
+}
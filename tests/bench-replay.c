@@ -0,0 +1,419 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define USE_THREAD
+#include <mt_list.h>
+#include "bench.h"
+
+/* Trace-replay benchmark for mt_lists. Compile this way:
+ *    cc -O2 -o bench-replay bench-replay.c -I../include -pthread
+ * It takes a trace file, the number of threads and optionally the number of
+ * times the trace is replayed (default 1):
+ * ./bench-replay capture.txt 8 10
+ *
+ * The trace is a text file with one operation per line:
+ *
+ *   <thread> <op> <list> <element> <think_ns>
+ *
+ * <thread> identifies the stream the operation belongs to. Streams are
+ * distributed over the replay threads (stream N is replayed by thread N modulo
+ * the number of threads), and each stream is replayed in order. <op> is one of
+ * "insert", "append", "delete", "pop", "behead" or "walk". <list> and
+ * <element> are small integers designating list heads and elements which are
+ * allocated by the benchmark (<element> is ignored by pop, behead and walk).
+ * <think_ns> is the time to spend before the operation, busy-waiting. Since
+ * the streams were captured with a different timing, the operations may not
+ * be consistent (e.g. inserting an element that is still in a list), so that
+ * insertions are performed using mt_list_try_insert() and mt_list_try_append()
+ * which ignore elements already in a list, and these are counted as misses.
+ * Just like with the library itself, "behead" must not be used on lists whose
+ * elements may be deleted by other streams.
+ * Empty lines and lines starting with '#' are ignored.
+ *
+ * The total throughput and the latency distribution of each operation type are
+ * reported. When BENCH_PERF is set in the environment, the hardware counters
+ * of all threads are reported as well, normalized per operation, and when built
+ * with -DMT_LIST_DELAY, BENCH_DELAY injects delays inside the critical sections
+ * (see bench.h).
+ *
+ * BENCH_PLACE selects how threads are pinned to CPUs (see bench.h). When it
+ * contains a comma-separated list of placements, the trace is replayed once
+ * per placement, starting from empty lists each time, and the throughput of
+ * all placements is summarized at the end:
+ *   BENCH_PLACE=compact,scatter,smt,llc ./bench-replay capture.txt 8
+ *
+ * With BENCH_REPEAT, each placement is replayed several times, and the mean
+ * latency of each operation type as well as the time per operation are kept
+ * as metrics named "<placement>/<op>" and "<placement>/total", which can be
+ * saved to a baseline file and compared against it (see bench.h). The program
+ * then exits with status 2 when a significant regression is found:
+ *   BENCH_REPEAT=10 BENCH_SAVE=base.txt ./bench-replay capture.txt 8
+ *   BENCH_REPEAT=10 BENCH_BASELINE=base.txt ./bench-replay capture.txt 8
+ */
+
+#define OP_INSERT  0
+#define OP_APPEND  1
+#define OP_DELETE  2
+#define OP_POP     3
+#define OP_BEHEAD  4
+#define OP_WALK    5
+#define OP_TYPES   6
+
+static const char *op_names[OP_TYPES] = {
+	"insert", "append", "delete", "pop", "behead", "walk",
+};
+
+struct op {
+	uint32_t type;
+	uint32_t list;
+	uint32_t elem;
+	uint32_t think;
+};
+
+struct elem {
+	struct mt_list list;
+};
+
+/* one stream of operations from the trace */
+struct stream {
+	struct op *ops;
+	unsigned int nb, size;
+};
+
+/* per-thread results */
+struct result {
+	uint64_t ops[OP_TYPES];
+	uint64_t misses[OP_TYPES];   /* nothing done (empty list, already in list) */
+	uint64_t lat[OP_TYPES][BENCH_LAT_BUCKETS];
+	uint64_t lat_max[OP_TYPES];
+	uint64_t lat_sum[OP_TYPES];
+	uint64_t walked;             /* elements visited by walks */
+};
+
+struct thread_ctx {
+	pthread_t thr;
+	unsigned int id;
+	int cpu;                     /* CPU to pin to, or -1 */
+	struct result res;
+	struct bench_counters cnt;
+};
+
+static struct stream *streams;
+static unsigned int nb_streams;
+static struct mt_list *lists;
+static unsigned int nb_lists;
+static struct elem *elems;
+static unsigned int nb_elems;
+static unsigned int nb_threads, loops = 1;
+
+static volatile int start_flag;
+
+static void think(uint32_t ns)
+{
+	uint64_t end;
+
+	if (!ns)
+		return;
+	end = bench_now_ns() + ns;
+	while (bench_now_ns() < end)
+		mt_list_cpu_relax1();
+}
+
+static long replay_op(const struct op *op, struct result *res)
+{
+	struct mt_list *lh = &lists[op->list];
+	struct mt_list *el = &elems[op->elem].list;
+	struct mt_list *n, *next;
+	struct mt_list back;
+	struct elem *item;
+
+	switch (op->type) {
+	case OP_INSERT:
+		return mt_list_try_insert(lh, el);
+	case OP_APPEND:
+		return mt_list_try_append(lh, el);
+	case OP_DELETE:
+		return mt_list_delete(el);
+	case OP_POP:
+		return !!mt_list_pop(lh);
+	case OP_BEHEAD:
+		n = mt_list_behead(lh);
+		if (!n)
+			return 0;
+		/* the chain is ours and ends with NULL, release all elements */
+		for (; n; n = next) {
+			next = n->next;
+			mt_list_init(n);
+		}
+		return 1;
+	case OP_WALK:
+		MT_LIST_FOR_EACH_ENTRY_LOCKED(item, lh, list, back)
+			res->walked++;
+		return 1;
+	}
+	return 0;
+}
+
+void *thread(void *arg)
+{
+	struct thread_ctx *ctx = arg;
+	const struct stream *st;
+	const struct op *op;
+	struct bench_perf perf;
+	uint64_t t0, lat;
+	unsigned int s, i, l;
+
+	if (bench_pin(ctx->cpu) < 0)
+		printf("thread %u: failed to pin to CPU %d.\n", ctx->id, ctx->cpu);
+	bench_perf_init(&perf);
+	while (!start_flag)
+		mt_list_cpu_relax1();
+
+	bench_perf_start(&perf);
+
+	for (l = 0; l < loops; l++) {
+		for (s = ctx->id; s < nb_streams; s += nb_threads) {
+			st = &streams[s];
+			for (i = 0; i < st->nb; i++) {
+				op = &st->ops[i];
+				think(op->think);
+
+				t0 = bench_now_ns();
+				if (!replay_op(op, &ctx->res))
+					ctx->res.misses[op->type]++;
+				lat = bench_now_ns() - t0;
+
+				ctx->res.ops[op->type]++;
+				ctx->res.lat[op->type][bench_lat_bucket(lat)]++;
+				ctx->res.lat_sum[op->type] += lat;
+				if (lat > ctx->res.lat_max[op->type])
+					ctx->res.lat_max[op->type] = lat;
+			}
+		}
+	}
+	bench_perf_stop(&perf, &ctx->cnt);
+	bench_perf_close(&perf);
+	return NULL;
+}
+
+/* loads trace file <path>, returns the number of operations or exits */
+static unsigned long load_trace(const char *path)
+{
+	char line[256], opname[32];
+	unsigned int thr, list, elem, think;
+	unsigned long nbops = 0, linenum = 0;
+	struct stream *st;
+	struct op op;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		linenum++;
+		if (*line == '#' || *line == '\n')
+			continue;
+
+		if (sscanf(line, "%u %31s %u %u %u", &thr, opname, &list, &elem, &think) != 5) {
+			printf("%s:%lu: invalid line\n", path, linenum);
+			exit(1);
+		}
+
+		for (op.type = 0; op.type < OP_TYPES; op.type++)
+			if (strcmp(opname, op_names[op.type]) == 0)
+				break;
+		if (op.type == OP_TYPES) {
+			printf("%s:%lu: unknown operation '%s'\n", path, linenum, opname);
+			exit(1);
+		}
+		op.list  = list;
+		op.elem  = elem;
+		op.think = think;
+
+		if (list >= nb_lists)
+			nb_lists = list + 1;
+		if (elem >= nb_elems)
+			nb_elems = elem + 1;
+
+		if (thr >= nb_streams) {
+			streams = realloc(streams, (thr + 1) * sizeof(*streams));
+			if (!streams)
+				goto oom;
+			memset(streams + nb_streams, 0, (thr + 1 - nb_streams) * sizeof(*streams));
+			nb_streams = thr + 1;
+		}
+
+		st = &streams[thr];
+		if (st->nb == st->size) {
+			st->size = st->size ? st->size * 2 : 1024;
+			st->ops = realloc(st->ops, st->size * sizeof(*st->ops));
+			if (!st->ops)
+				goto oom;
+		}
+		st->ops[st->nb++] = op;
+		nbops++;
+	}
+	fclose(f);
+	return nbops;
+ oom:
+	printf("Out of memory.\n");
+	exit(1);
+}
+
+/* replays the trace with threads placed according to <place> and reports the
+ * results, which are also added to metrics <ms>. Returns the throughput in
+ * operations per second.
+ */
+static double run(int place, struct thread_ctx *ctx, struct bench_metrics *ms)
+{
+	char name[48];
+	struct result total;
+	struct bench_counters cnt = { };
+	uint64_t t0, duration, all = 0;
+	unsigned int i, t, op, b;
+	int cpus[nb_threads];
+
+	for (i = 0; i < nb_lists; i++)
+		mt_list_init(&lists[i]);
+	for (i = 0; i < nb_elems; i++)
+		mt_list_init(&elems[i].list);
+
+	bench_place_cpus(place, cpus, nb_threads);
+	printf("\nplacement: %s, CPUs:", bench_place_names[place]);
+	for (t = 0; t < nb_threads; t++)
+		printf(cpus[t] < 0 ? " any" : " %d", cpus[t]);
+	printf("\n");
+
+	start_flag = 0;
+	memset(ctx, 0, nb_threads * sizeof(*ctx));
+	for (t = 0; t < nb_threads; t++) {
+		ctx[t].id = t;
+		ctx[t].cpu = cpus[t];
+		if (pthread_create(&ctx[t].thr, NULL, thread, &ctx[t]) != 0) {
+			printf("Failed to create thread %u.\n", t);
+			exit(1);
+		}
+	}
+
+	t0 = bench_now_ns();
+	start_flag = 1;
+	for (t = 0; t < nb_threads; t++)
+		pthread_join(ctx[t].thr, NULL);
+	duration = bench_now_ns() - t0;
+
+	memset(&total, 0, sizeof(total));
+	for (t = 0; t < nb_threads; t++) {
+		for (op = 0; op < OP_TYPES; op++) {
+			total.ops[op]    += ctx[t].res.ops[op];
+			total.misses[op] += ctx[t].res.misses[op];
+			total.lat_sum[op] += ctx[t].res.lat_sum[op];
+			for (b = 0; b < BENCH_LAT_BUCKETS; b++)
+				total.lat[op][b] += ctx[t].res.lat[op][b];
+			if (ctx[t].res.lat_max[op] > total.lat_max[op])
+				total.lat_max[op] = ctx[t].res.lat_max[op];
+		}
+		total.walked += ctx[t].res.walked;
+		bench_counters_add(&cnt, &ctx[t].cnt);
+	}
+
+	printf("%-8s %12s %10s %8s %8s %8s %10s\n",
+	       "op", "count", "misses", "p50_ns", "p99_ns", "p999_ns", "max_ns");
+	for (op = 0; op < OP_TYPES; op++) {
+		if (!total.ops[op])
+			continue;
+		all += total.ops[op];
+		snprintf(name, sizeof(name), "%s/%s", bench_place_names[place], op_names[op]);
+		bench_metric_add(ms, name, (double)total.lat_sum[op] / total.ops[op]);
+		printf("%-8s %12llu %10llu %8llu %8llu %8llu %10llu\n", op_names[op],
+		       (unsigned long long)total.ops[op], (unsigned long long)total.misses[op],
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 50),
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 99),
+		       (unsigned long long)bench_percentile(total.lat[op], total.ops[op], 99.9),
+		       (unsigned long long)total.lat_max[op]);
+	}
+	if (total.walked)
+		printf("walks visited %llu elements\n", (unsigned long long)total.walked);
+
+	printf("total: %llu ops in %.3f ms, %.0f ops/s\n", (unsigned long long)all,
+	       duration / 1e6, all * 1e9 / duration);
+	bench_counters_print("counters", &cnt, all);
+	snprintf(name, sizeof(name), "%s/total", bench_place_names[place]);
+	bench_metric_add(ms, name, (double)duration / all);
+	return all * 1e9 / duration;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct bench_metrics ms;
+	struct thread_ctx *ctx;
+	const char *places, *p;
+	double rate[BENCH_MAX_PLACES];
+	int place[BENCH_MAX_PLACES];
+	unsigned long nbops;
+	unsigned int nb_places = 0, nb_reps, i, r;
+
+	if (argc < 3) {
+		printf("Usage: %s <trace_file> <nb_threads> [<loops>]\n", argv[0]);
+		exit(1);
+	}
+
+	nb_threads = atoi(argv[2]);
+	if (argc > 3)
+		loops = atoi(argv[3]);
+	if (nb_threads < 1 || loops < 1) {
+		printf("Need at least one thread and one loop.\n");
+		exit(1);
+	}
+
+	if (bench_delay_init() < 0)
+		exit(1);
+
+	places = p = bench_place_list();
+	while ((place[nb_places] = bench_place_next(&p)) != -2) {
+		if (place[nb_places] < 0) {
+			printf("Unknown placement in '%s'.\n", places);
+			exit(1);
+		}
+		if (++nb_places == BENCH_MAX_PLACES)
+			break;
+	}
+	if (!bench_topo_load() && (nb_places > 1 || place[0] > 0)) {
+		printf("CPU topology not available, cannot place threads.\n");
+		exit(1);
+	}
+
+	nbops = load_trace(argv[1]);
+	if (!nbops) {
+		printf("%s: empty trace.\n", argv[1]);
+		exit(1);
+	}
+
+	lists = malloc(nb_lists * sizeof(*lists));
+	elems = malloc(nb_elems * sizeof(*elems));
+	ctx = calloc(nb_threads, sizeof(*ctx));
+	if (!lists || !elems || !ctx) {
+		printf("Out of memory.\n");
+		exit(1);
+	}
+
+	printf("trace: %lu ops in %u streams, %u lists, %u elements, %u threads, %u loops\n",
+	       nbops, nb_streams, nb_lists, nb_elems, nb_threads, loops);
+
+	nb_reps = bench_repeat();
+	for (i = 0; i < nb_places; i++) {
+		for (rate[i] = 0, r = 0; r < nb_reps; r++)
+			rate[i] += run(place[i], ctx, &ms) / nb_reps;
+	}
+
+	if (nb_places > 1) {
+		printf("\n%-10s %14s %8s\n", "placement", "ops/s", "ratio");
+		for (i = 0; i < nb_places; i++)
+			printf("%-10s %14.0f %8.3f\n", bench_place_names[place[i]], rate[i], rate[i] / rate[0]);
+	}
+	return bench_metrics_finish(&ms);
+}
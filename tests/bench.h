@@ -0,0 +1,973 @@
+/*
+ * tests/bench.h
+ *
+ * Helpers shared by the benchmark programs.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mt_list.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* Hardware performance counters. When the BENCH_PERF environment variable is
+ * set, each measuring thread opens a group of counters for itself using
+ * perf_event_open(): cycles, instructions, cache misses, and optionally a
+ * model-specific coherence event such as HITM, whose raw code is passed in
+ * BENCH_HITM (e.g. BENCH_HITM=0x4d2 for MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM on
+ * Skylake). The CPU's cycle counter (or the monotonic clock) is always read,
+ * so that when the counters are not available (not Linux, no permission,
+ * virtual machine), only this one is reported.
+ */
+#define BENCH_CNT_CYCLES  0
+#define BENCH_CNT_INSTR   1
+#define BENCH_CNT_MISSES  2
+#define BENCH_CNT_HITM    3
+#define BENCH_CNT_NB      4
+
+static const char *bench_cnt_names[BENCH_CNT_NB] = {
+	"cycles", "instr", "misses", "hitm",
+};
+
+/* values accumulated over one or several measured phases */
+struct bench_counters {
+	uint64_t val[BENCH_CNT_NB];   /* hardware counters */
+	uint64_t tsc;                 /* cycle counter or nanoseconds */
+	unsigned int valid;           /* mask of 1 << BENCH_CNT_* collected */
+};
+
+/* per-thread measurement context */
+struct bench_perf {
+	int fd[BENCH_CNT_NB];         /* -1 when not available */
+	int leader;                   /* fd of the group leader or -1 */
+	int nb;                       /* number of counters in the group */
+	int idx[BENCH_CNT_NB];        /* position in the group of each counter */
+	struct bench_counters start;
+};
+
+/* Returns the CPU's cycle counter, or the monotonic clock in nanoseconds
+ * where there is no such counter.
+ */
+static inline uint64_t bench_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+	uint64_t cnt;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r"(cnt));
+	return cnt;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#if defined(__linux__)
+/* opens counter <type>/<config> for the calling thread in group <leader> */
+static inline int bench_perf_open_one(uint32_t type, uint64_t config, int leader)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = leader < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+}
+#endif
+
+/* Prepares the counters for the calling thread. It never fails: counters which
+ * cannot be opened are simply not reported.
+ */
+static inline void bench_perf_init(struct bench_perf *p)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->leader = -1;
+	for (i = 0; i < BENCH_CNT_NB; i++)
+		p->fd[i] = -1;
+
+#if defined(__linux__)
+	if (!getenv("BENCH_PERF"))
+		return;
+
+	p->fd[BENCH_CNT_CYCLES] = bench_perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+	if (p->fd[BENCH_CNT_CYCLES] < 0)
+		return;
+	p->leader = p->fd[BENCH_CNT_CYCLES];
+
+	p->fd[BENCH_CNT_INSTR]  = bench_perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, p->leader);
+	p->fd[BENCH_CNT_MISSES] = bench_perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, p->leader);
+	if (getenv("BENCH_HITM"))
+		p->fd[BENCH_CNT_HITM] = bench_perf_open_one(PERF_TYPE_RAW, strtoull(getenv("BENCH_HITM"), NULL, 0), p->leader);
+
+	/* values are reported in the order the counters were added */
+	for (i = 0; i < BENCH_CNT_NB; i++)
+		if (p->fd[i] >= 0)
+			p->idx[i] = p->nb++;
+#endif
+}
+
+/* reads the current values of the counters into <c> */
+static inline void bench_perf_read(struct bench_perf *p, struct bench_counters *c)
+{
+	int i;
+
+	memset(c, 0, sizeof(*c));
+#if defined(__linux__)
+	if (p->leader >= 0) {
+		uint64_t buf[3 + BENCH_CNT_NB];
+		double scale = 1.0;
+
+		/* nr, time_enabled, time_running, values... */
+		if (read(p->leader, buf, sizeof(buf)) >= (ssize_t)((3 + p->nb) * sizeof(uint64_t))) {
+			if (buf[2] && buf[2] < buf[1])
+				scale = (double)buf[1] / buf[2];  /* multiplexed */
+			for (i = 0; i < BENCH_CNT_NB; i++) {
+				if (p->fd[i] < 0)
+					continue;
+				c->val[i] = buf[3 + p->idx[i]] * scale;
+				c->valid |= 1 << i;
+			}
+		}
+	}
+#endif
+	c->tsc = bench_tsc();
+}
+
+/* starts a measured phase */
+static inline void bench_perf_start(struct bench_perf *p)
+{
+#if defined(__linux__)
+	if (p->leader >= 0)
+		ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	bench_perf_read(p, &p->start);
+}
+
+/* ends a measured phase and adds the values measured since its start to <c> */
+static inline void bench_perf_stop(struct bench_perf *p, struct bench_counters *c)
+{
+	struct bench_counters end;
+	int i;
+
+	bench_perf_read(p, &end);
+	for (i = 0; i < BENCH_CNT_NB; i++)
+		c->val[i] += end.val[i] - p->start.val[i];
+	c->tsc += end.tsc - p->start.tsc;
+	c->valid |= end.valid;
+#if defined(__linux__)
+	if (p->leader >= 0)
+		ioctl(p->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+/* releases the counters */
+static inline void bench_perf_close(struct bench_perf *p)
+{
+	int i;
+
+	for (i = 0; i < BENCH_CNT_NB; i++)
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+	p->leader = -1;
+}
+
+/* adds counters <src> to <dst>, typically to sum per-thread values */
+static inline void bench_counters_add(struct bench_counters *dst, const struct bench_counters *src)
+{
+	int i;
+
+	for (i = 0; i < BENCH_CNT_NB; i++)
+		dst->val[i] += src->val[i];
+	dst->tsc += src->tsc;
+	dst->valid |= src->valid;
+}
+
+/* Prints counters <c> normalized per operation for <ops> operations, on a
+ * single line starting with <name>. Counters which were not collected are not
+ * printed.
+ */
+static inline void bench_counters_print(const char *name, const struct bench_counters *c, uint64_t ops)
+{
+	int i;
+
+	if (!ops)
+		ops = 1;
+	printf("%s: tsc/op=%.2f", name, (double)c->tsc / ops);
+	for (i = 0; i < BENCH_CNT_NB; i++)
+		if (c->valid & (1 << i))
+			printf(" %s/op=%.2f", bench_cnt_names[i], (double)c->val[i] / ops);
+	if ((c->valid & (1 << BENCH_CNT_CYCLES)) && (c->valid & (1 << BENCH_CNT_INSTR)) && c->val[BENCH_CNT_CYCLES])
+		printf(" ipc=%.2f", (double)c->val[BENCH_CNT_INSTR] / c->val[BENCH_CNT_CYCLES]);
+	if (!(c->valid & (1 << BENCH_CNT_CYCLES)) && getenv("BENCH_PERF"))
+		printf(" (counters unavailable)");
+	printf("\n");
+}
+
+
+/* Names of the operations identified by MT_LIST_TR_* */
+static const char *bench_op_names[MT_LIST_TR_OPS] = {
+	[0]                     = "unknown",
+	[MT_LIST_TR_TRY_INSERT] = "try_insert",
+	[MT_LIST_TR_TRY_APPEND] = "try_append",
+	[MT_LIST_TR_BEHEAD]     = "behead",
+	[MT_LIST_TR_INSERT]     = "insert",
+	[MT_LIST_TR_APPEND]     = "append",
+	[MT_LIST_TR_DELETE]     = "delete",
+	[MT_LIST_TR_POP]        = "pop",
+	[MT_LIST_TR_POP_IF]     = "pop_if",
+	[MT_LIST_TR_CUT]        = "cut",
+	[MT_LIST_TR_MERGE]      = "merge",
+	[MT_LIST_TR_LOCK_NEXT]  = "lock_next",
+	[MT_LIST_TR_LOCK_PREV]  = "lock_prev",
+	[MT_LIST_TR_LOCK_ELEM]  = "lock_elem",
+	[MT_LIST_TR_LOCK_FULL]  = "lock_full",
+	[MT_LIST_TR_APPLY]      = "apply",
+	[MT_LIST_TR_WALK]       = "walk",
+};
+
+/* Returns the monotonic time in nanoseconds */
+static inline uint64_t bench_now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Latencies are accounted in histograms of buckets of powers of two
+ * nanoseconds.
+ */
+#define BENCH_LAT_BUCKETS 40
+
+/* returns the bucket index for latency <ns>, i.e. its log2 rounded up */
+static inline unsigned int bench_lat_bucket(uint64_t ns)
+{
+	unsigned int b = 0;
+
+	while (ns > 1 && b < BENCH_LAT_BUCKETS - 1) {
+		ns = (ns + 1) >> 1;
+		b++;
+	}
+	return b;
+}
+
+/* returns the latency in ns below which <pct> percent of the <total>
+ * operations of histogram <lat> completed (upper bound of the bucket).
+ */
+static inline uint64_t bench_percentile(const uint64_t *lat, uint64_t total, double pct)
+{
+	uint64_t cumul = 0;
+	unsigned int b;
+
+	for (b = 0; b < BENCH_LAT_BUCKETS - 1; b++) {
+		cumul += lat[b];
+		if (cumul * 100.0 >= total * pct)
+			break;
+	}
+	return 1ULL << b;
+}
+
+/* Delay injection. When the programs are built with -DMT_LIST_DELAY and the
+ * BENCH_DELAY environment variable is set, a delay is injected inside the
+ * critical sections of the list operations (see MT_LIST_DELAY in mt_list.h).
+ * The variable has the form <dist>:<ns>[:<pct>[:<op>,...]] where <dist> is the
+ * distribution of the delays and <ns> their mean in nanoseconds:
+ *   - "const":   always <ns>
+ *   - "uniform": uniformly distributed between 0 and 2*<ns>
+ *   - "exp":     exponential distribution (many short, some long)
+ *   - "pareto":  Pareto distribution with alpha=1.5 (heavy tail)
+ * <pct> is the probability in percent that a delay is injected at each point
+ * (default 100), and the optional list of operation names (see bench_op_names)
+ * restricts the injection points to these operations. Example:
+ *
+ *   BENCH_DELAY=pareto:2000:5:pop,walk ./test-list 8
+ *
+ * Delays shorter than 100 microseconds are busy-waited, simulating a slow
+ * payload, and longer ones sleep, simulating the preemption of the holder.
+ * Each thread uses its own pseudo-random sequence, seeded in thread creation
+ * order, so that runs are repeatable.
+ */
+#define BENCH_DIST_CONST    0
+#define BENCH_DIST_UNIFORM  1
+#define BENCH_DIST_EXP      2
+#define BENCH_DIST_PARETO   3
+
+static const char *bench_dist_names[] = {
+	"const", "uniform", "exp", "pareto",
+};
+
+static struct {
+	int dist;           /* BENCH_DIST_* */
+	double ns;          /* mean delay */
+	uint32_t pct;       /* probability of a delay, in 1/2^32 units */
+	uint32_t points;    /* mask of 1 << MT_LIST_TR_* */
+} bench_delay;
+
+static unsigned int bench_delay_seed;
+static __thread uint32_t bench_delay_rnd;
+
+/* returns a pseudo-random 32-bit number from the thread's sequence */
+static inline uint32_t bench_delay_random()
+{
+	uint32_t x = bench_delay_rnd;
+
+	if (!x)
+		x = 2463534242U + __atomic_add_fetch(&bench_delay_seed, 1, __ATOMIC_RELAXED) * 0x9E3779B9U;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return bench_delay_rnd = x;
+}
+
+/* returns a pseudo-random number in ]0,1[ */
+static inline double bench_delay_unit()
+{
+	return (bench_delay_random() + 0.5) / 4294967296.0;
+}
+
+/* the hook installed into mt_list_delay_hook */
+static inline void bench_delay_hook(unsigned int op)
+{
+	uint64_t ns, end;
+
+	if (!(bench_delay.points & (1U << op)))
+		return;
+	if (bench_delay.pct != ~0U && bench_delay_random() >= bench_delay.pct)
+		return;
+
+	switch (bench_delay.dist) {
+	case BENCH_DIST_UNIFORM:
+		ns = 2 * bench_delay.ns * bench_delay_unit();
+		break;
+	case BENCH_DIST_EXP:
+		ns = -bench_delay.ns * log(bench_delay_unit());
+		break;
+	case BENCH_DIST_PARETO:
+		/* mean = xm * alpha / (alpha - 1) = 3 * xm for alpha = 1.5 */
+		ns = bench_delay.ns / 3 / pow(bench_delay_unit(), 1 / 1.5);
+		break;
+	default:
+		ns = bench_delay.ns;
+		break;
+	}
+
+	if (ns >= 100000) {
+		struct timespec ts;
+
+		ts.tv_sec  = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+
+		nanosleep(&ts, NULL);
+		return;
+	}
+
+	end = bench_now_ns() + ns;
+	while (bench_now_ns() < end)
+		mt_list_cpu_relax1();
+}
+
+/* Parses BENCH_DELAY and installs the delay hook. Returns 0 on success or if
+ * the variable is not set, otherwise prints an error and returns -1. The spec
+ * is always parsed first so that invalid ones are reported the same way when
+ * MT_LIST_DELAY is not defined, in which case a valid one fails afterwards.
+ */
+static inline int bench_delay_init()
+{
+	const char *spec = getenv("BENCH_DELAY");
+	char name[32];
+	const char *p;
+	unsigned int pct = 100;
+	size_t len;
+	int op;
+
+	if (!spec)
+		return 0;
+
+	p = strchr(spec, ':');
+	if (!p)
+		goto bad;
+	for (bench_delay.dist = 0; bench_delay.dist < (int)(sizeof(bench_dist_names) / sizeof(*bench_dist_names)); bench_delay.dist++) {
+		if (strlen(bench_dist_names[bench_delay.dist]) == (size_t)(p - spec) &&
+		    strncmp(spec, bench_dist_names[bench_delay.dist], p - spec) == 0)
+			break;
+	}
+	if (bench_delay.dist == (int)(sizeof(bench_dist_names) / sizeof(*bench_dist_names)))
+		goto bad;
+
+	bench_delay.ns = strtod(p + 1, (char **)&p);
+	if (*p == ':')
+		pct = strtoul(p + 1, (char **)&p, 10);
+	if (pct > 100 || (*p && *p != ':'))
+		goto bad;
+	bench_delay.pct = pct == 100 ? ~0U : (uint32_t)(pct * 42949672.96);
+
+	if (*p != ':') {
+		bench_delay.points = ~0U;
+	}
+	else {
+		for (p++; *p; p += len + !!p[len]) {
+			len = strcspn(p, ",");
+			if (len >= sizeof(name))
+				goto bad;
+			memcpy(name, p, len);
+			name[len] = 0;
+			for (op = 1; op < MT_LIST_TR_OPS; op++)
+				if (strcmp(name, bench_op_names[op]) == 0)
+					break;
+			if (op == MT_LIST_TR_OPS)
+				goto bad;
+			bench_delay.points |= 1U << op;
+		}
+	}
+
+#if defined(MT_LIST_DELAY)
+	mt_list_delay_hook = bench_delay_hook;
+	return 0;
+#else
+	printf("BENCH_DELAY requires building with -DMT_LIST_DELAY.\n");
+	return -1;
+#endif
+ bad:
+	printf("Invalid BENCH_DELAY '%s', expected <dist>:<ns>[:<pct>[:<op>,...]] with dist among const, uniform, exp, pareto.\n", spec);
+	return -1;
+}
+
+
+/* CPU topology and thread placement. The topology of the online CPUs is read
+ * from /sys/devices/system/cpu (or from the directory designated by the
+ * BENCH_SYSFS environment variable, e.g. a copy taken on another machine) and
+ * the BENCH_PLACE environment variable selects how threads are pinned:
+ *   - "none":    no pinning, placement is left to the scheduler (default)
+ *   - "compact": threads fill the SMT siblings of a core, then the cores
+ *                sharing the same LLC, then the next LLC and package
+ *   - "scatter": threads are spread over packages first, then LLCs, then
+ *                cores, and SMT siblings are only used once all cores are
+ *   - "smt":     threads go by pairs on the two siblings of a same core,
+ *                pairs being spread like with "scatter"
+ *   - "llc":     one thread per LLC, spread over packages
+ * When there are more threads than CPUs in the resulting order, it wraps. A
+ * comma-separated list of placements may be passed to programs which support
+ * running once per placement.
+ */
+#define BENCH_MAX_CPUS   1024
+#define BENCH_MAX_PLACES 16
+
+struct bench_cpu {
+	int cpu;      /* CPU number */
+	int pkg;      /* physical package id */
+	int llc;      /* id of the last level cache */
+	int core;     /* core id, unique within the package */
+	int smt;      /* rank among the core's siblings */
+	int rank;     /* rank of the core within its LLC or of the LLC within
+	               * its package, used to spread threads */
+};
+
+static struct bench_cpu bench_cpus[BENCH_MAX_CPUS];
+static int bench_nbcpus;
+
+static const char *bench_place_names[] = {
+	"none", "compact", "scatter", "smt", "llc",
+};
+
+/* reads an integer from file <dir>/<file>, or returns <def> */
+static inline int bench_read_int(const char *dir, const char *file, int def)
+{
+	char path[512];
+	FILE *f;
+	int val;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	f = fopen(path, "r");
+	if (!f)
+		return def;
+	if (fscanf(f, "%d", &val) != 1)
+		val = def;
+	fclose(f);
+	return val;
+}
+
+/* Reads CPU list file <dir>/<file> (e.g. "0-3,8-11") and returns the number
+ * of CPUs stored into <cpus>, at most <max>. Returns 0 if it can't be read.
+ */
+static inline int bench_read_cpulist(const char *dir, const char *file, int *cpus, int max)
+{
+	char path[512];
+	int nb = 0, a, b;
+	FILE *f;
+	char c;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	while (fscanf(f, "%d", &a) == 1) {
+		b = a;
+		c = fgetc(f);
+		if (c == '-') {
+			if (fscanf(f, "%d", &b) != 1)
+				break;
+			c = fgetc(f);
+		}
+		for (; a <= b && nb < max; a++)
+			cpus[nb++] = a;
+		if (c != ',')
+			break;
+	}
+	fclose(f);
+	return nb;
+}
+
+/* compares CPUs for the "compact" order */
+static inline int bench_cmp_compact(const void *a, const void *b)
+{
+	const struct bench_cpu *x = (const struct bench_cpu *)a, *y = (const struct bench_cpu *)b;
+
+	if (x->pkg != y->pkg)
+		return x->pkg - y->pkg;
+	if (x->llc != y->llc)
+		return x->llc - y->llc;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->smt - y->smt;
+}
+
+/* compares CPUs for the "scatter" order: SMT rank first, then core rank in
+ * the LLC, then LLC rank in the package, then package.
+ */
+static inline int bench_cmp_scatter(const void *a, const void *b)
+{
+	const struct bench_cpu *x = (const struct bench_cpu *)a, *y = (const struct bench_cpu *)b;
+
+	if (x->smt != y->smt)
+		return x->smt - y->smt;
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	return bench_cmp_compact(a, b);
+}
+
+/* Loads the topology of the online CPUs. Returns the number of CPUs, or 0 if
+ * the topology is not available.
+ */
+static inline int bench_topo_load()
+{
+	const char *root = getenv("BENCH_SYSFS") ? getenv("BENCH_SYSFS") : "/sys/devices/system/cpu";
+	static int list[BENCH_MAX_CPUS];
+	char dir[256], file[64];
+	struct bench_cpu *c;
+	int nb, i, j, idx, lvl, best;
+	int llc_rank, core_rank;
+
+	nb = bench_read_cpulist(root, "online", list, BENCH_MAX_CPUS);
+	for (i = 0; i < nb; i++) {
+		c = &bench_cpus[i];
+		c->cpu = list[i];
+		snprintf(dir, sizeof(dir), "%s/cpu%d", root, c->cpu);
+		c->pkg  = bench_read_int(dir, "topology/physical_package_id", 0);
+		c->core = bench_read_int(dir, "topology/core_id", c->cpu);
+
+		/* the SMT rank is the position in the list of siblings */
+		c->smt = 0;
+		j = bench_read_cpulist(dir, "topology/thread_siblings_list", list + nb, BENCH_MAX_CPUS - nb);
+		for (idx = 0; idx < j; idx++)
+			if (list[nb + idx] == c->cpu)
+				c->smt = idx;
+
+		/* the LLC is the cache index with the highest level */
+		c->llc = c->pkg;
+		for (idx = 0, best = 0; idx < 8; idx++) {
+			snprintf(file, sizeof(file), "cache/index%d/level", idx);
+			lvl = bench_read_int(dir, file, -1);
+			if (lvl < 0)
+				break;
+			if (lvl < best)
+				continue;
+			best = lvl;
+			snprintf(file, sizeof(file), "cache/index%d/id", idx);
+			c->llc = bench_read_int(dir, file, -1);
+			if (c->llc < 0) {
+				/* no id, identify it by its first CPU */
+				snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", idx);
+				c->llc = bench_read_cpulist(dir, file, &c->llc, 1) ? c->llc : c->pkg;
+			}
+		}
+	}
+	bench_nbcpus = nb;
+
+	/* rank the cores within their LLC and the LLCs within their package.
+	 * Cores come first so that threads are spread over the LLCs of all
+	 * packages before sharing an LLC.
+	 */
+	qsort(bench_cpus, nb, sizeof(*bench_cpus), bench_cmp_compact);
+	for (i = 0, llc_rank = core_rank = 0; i < nb; i++) {
+		if (i && bench_cpus[i].pkg != bench_cpus[i - 1].pkg)
+			llc_rank = core_rank = 0;
+		else if (i && bench_cpus[i].llc != bench_cpus[i - 1].llc) {
+			llc_rank++;
+			core_rank = 0;
+		}
+		else if (i && bench_cpus[i].core != bench_cpus[i - 1].core)
+			core_rank++;
+		bench_cpus[i].rank = core_rank * BENCH_MAX_CPUS + llc_rank;
+	}
+	return nb;
+}
+
+/* Returns the index of placement <name> of length <len>, or -1 if unknown */
+static inline int bench_place_find(const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(bench_place_names) / sizeof(*bench_place_names)); i++)
+		if (strlen(bench_place_names[i]) == len && strncmp(name, bench_place_names[i], len) == 0)
+			return i;
+	return -1;
+}
+
+/* Fills <cpus> with the CPU each of the <nb> threads must be pinned to for
+ * placement <place> (index in bench_place_names), or -1 for no pinning.
+ * bench_topo_load() must have been called first.
+ */
+static inline void bench_place_cpus(int place, int *cpus, int nb)
+{
+	struct bench_cpu order[BENCH_MAX_CPUS];
+	int nbo = 0, i, j;
+
+	for (i = 0; i < nb; i++)
+		cpus[i] = -1;
+	if (place <= 0 || !bench_nbcpus)
+		return;
+
+	memcpy(order, bench_cpus, bench_nbcpus * sizeof(*order));
+	qsort(order, bench_nbcpus, sizeof(*order), place == 1 ? bench_cmp_compact : bench_cmp_scatter);
+	nbo = bench_nbcpus;
+
+	if (place == 3) {
+		/* smt: first sibling of each core in scatter order, each one
+		 * followed by its own siblings.
+		 */
+		struct bench_cpu pairs[BENCH_MAX_CPUS];
+		int nbp = 0;
+
+		for (i = 0; i < nbo && !order[i].smt; i++) {
+			for (j = 0; j < nbo; j++)
+				if (order[j].pkg == order[i].pkg && order[j].core == order[i].core)
+					pairs[nbp++] = order[j];
+		}
+		memcpy(order, pairs, nbp * sizeof(*order));
+		nbo = nbp;
+	}
+	else if (place == 4) {
+		/* llc: first CPU of each LLC in scatter order */
+		for (i = j = 0; i < nbo; i++) {
+			if (order[i].smt || order[i].rank >= BENCH_MAX_CPUS)
+				continue;
+			order[j++] = order[i];
+		}
+		nbo = j;
+	}
+
+	for (i = 0; i < nb && nbo; i++)
+		cpus[i] = order[i % nbo].cpu;
+}
+
+/* Pins the calling thread to CPU <cpu>. Nothing is done if <cpu> is negative.
+ * Returns 0 on success, otherwise -1.
+ */
+static inline int bench_pin(int cpu)
+{
+#if defined(__linux__)
+	unsigned long mask[BENCH_MAX_CPUS / (8 * sizeof(long))];
+
+	if (cpu < 0)
+		return 0;
+	memset(mask, 0, sizeof(mask));
+	mask[cpu / (8 * sizeof(long))] = 1UL << (cpu % (8 * sizeof(long)));
+	return syscall(__NR_sched_setaffinity, 0, sizeof(mask), mask) == 0 ? 0 : -1;
+#else
+	return cpu < 0 ? 0 : -1;
+#endif
+}
+
+/* Returns the list of placements passed in BENCH_PLACE, or "none" */
+static inline const char *bench_place_list()
+{
+	const char *list = getenv("BENCH_PLACE");
+
+	return list && *list ? list : "none";
+}
+
+/* Parses the first placement of comma-separated list <list>, advances <list>
+ * past it, and returns its index, or -1 if it is unknown, or -2 at the end of
+ * the list.
+ */
+static inline int bench_place_next(const char **list)
+{
+	size_t len;
+	int place;
+
+	if (!**list)
+		return -2;
+	len = strcspn(*list, ",");
+	place = bench_place_find(*list, len);
+	*list += len + !!(*list)[len];
+	return place;
+}
+
+
+/* Baselines and regression detection. A benchmark may be repeated several
+ * times (BENCH_REPEAT, default 1), each repetition adding one sample to each of
+ * its metrics, which are costs where lower is better (e.g. ns per operation).
+ * The mean and standard deviation of each metric may be saved into a baseline
+ * file (BENCH_SAVE) and compared against a previously saved one
+ * (BENCH_BASELINE). A metric is reported as regressed when it is slower than
+ * the baseline by more than BENCH_TOLERANCE percent (default 5) and Welch's
+ * t-test says the difference is significant at the 95% level, so that noisy
+ * metrics need more repetitions to be flagged. The file is a text file with
+ * one metric per line:
+ *
+ *   <name> <samples> <mean> <stddev>
+ */
+#define BENCH_MAX_METRICS 128
+
+struct bench_metric {
+	char name[48];
+	unsigned int n;      /* number of samples */
+	double mean;
+	double m2;           /* sum of squared deviations (Welford) */
+};
+
+struct bench_metrics {
+	unsigned int nb;
+	struct bench_metric m[BENCH_MAX_METRICS];
+};
+
+/* adds sample <value> to metric <name> of <ms>, creating it if needed */
+static inline void bench_metric_add(struct bench_metrics *ms, const char *name, double value)
+{
+	struct bench_metric *m;
+	unsigned int i;
+	double delta;
+
+	for (i = 0; i < ms->nb; i++)
+		if (strcmp(ms->m[i].name, name) == 0)
+			break;
+	if (i == ms->nb) {
+		if (ms->nb == BENCH_MAX_METRICS)
+			return;
+		memset(&ms->m[i], 0, sizeof(ms->m[i]));
+		snprintf(ms->m[i].name, sizeof(ms->m[i].name), "%s", name);
+		ms->nb++;
+	}
+	m = &ms->m[i];
+	m->n++;
+	delta = value - m->mean;
+	m->mean += delta / m->n;
+	m->m2 += delta * (value - m->mean);
+}
+
+/* returns the variance of the mean of metric <m>, 0 with a single sample */
+static inline double bench_metric_var(const struct bench_metric *m)
+{
+	return m->n > 1 ? m->m2 / (m->n - 1) / m->n : 0;
+}
+
+/* returns the two-sided 95% quantile of Student's t distribution for <df>
+ * degrees of freedom.
+ */
+static inline double bench_t95(double df)
+{
+	static const double t[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+	};
+
+	if (df < 1)
+		return t[0];
+	if (df <= sizeof(t) / sizeof(*t))
+		return t[(int)df - 1];
+	return 1.960;
+}
+
+/* returns the half-width of the 95% confidence interval of the mean of <m> */
+static inline double bench_metric_ci(const struct bench_metric *m)
+{
+	return m->n > 1 ? bench_t95(m->n - 1) * sqrt(bench_metric_var(m)) : 0;
+}
+
+/* Saves metrics <ms> to file <path>. Returns 0 on success, otherwise -1. */
+static inline int bench_metrics_save(const struct bench_metrics *ms, const char *path)
+{
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "# <name> <samples> <mean> <stddev>\n");
+	for (i = 0; i < ms->nb; i++)
+		fprintf(f, "%s %u %.6g %.6g\n", ms->m[i].name, ms->m[i].n, ms->m[i].mean,
+		        ms->m[i].n > 1 ? sqrt(ms->m[i].m2 / (ms->m[i].n - 1)) : 0.0);
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Loads metrics <ms> from file <path>. Returns 0 on success, otherwise -1. */
+static inline int bench_metrics_load(struct bench_metrics *ms, const char *path)
+{
+	struct bench_metric *m;
+	char line[256];
+	double sd;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	ms->nb = 0;
+	while (fgets(line, sizeof(line), f) && ms->nb < BENCH_MAX_METRICS) {
+		if (*line == '#' || *line == '\n')
+			continue;
+		m = &ms->m[ms->nb];
+		if (sscanf(line, "%47s %u %lf %lf", m->name, &m->n, &m->mean, &sd) != 4 || !m->n) {
+			fclose(f);
+			return -1;
+		}
+		m->m2 = sd * sd * (m->n - 1);
+		ms->nb++;
+	}
+	fclose(f);
+	return 0;
+}
+
+/* Compares metrics <cur> against baseline <base> and prints the result of
+ * each metric present in both. <tol> is the tolerated slowdown in percent.
+ * Returns the number of significant regressions.
+ */
+static inline int bench_metrics_compare(const struct bench_metrics *cur, const struct bench_metrics *base, double tol)
+{
+	const struct bench_metric *c, *b;
+	double vc, vb, df, diff, ci;
+	unsigned int i, j;
+	const char *verdict;
+	int regressions = 0;
+
+	printf("\n%-24s %20s %20s %8s %s\n", "metric", "baseline", "current", "change", "verdict");
+	for (i = 0; i < cur->nb; i++) {
+		c = &cur->m[i];
+		for (j = 0; j < base->nb; j++)
+			if (strcmp(base->m[j].name, c->name) == 0)
+				break;
+		if (j == base->nb)
+			continue;
+		b = &base->m[j];
+
+		/* Welch's t-test on the difference of the means */
+		vc = bench_metric_var(c);
+		vb = bench_metric_var(b);
+		diff = c->mean - b->mean;
+		df = 1;
+		if (c->n > 1 && b->n > 1 && vc + vb > 0)
+			df = (vc + vb) * (vc + vb) / (vc * vc / (c->n - 1) + vb * vb / (b->n - 1));
+		ci = bench_t95(df) * sqrt(vc + vb);
+
+		if (c->n < 2 || b->n < 2)
+			verdict = "not enough samples";
+		else if (diff - ci > 0 && diff > b->mean * tol / 100.0) {
+			verdict = "REGRESSION";
+			regressions++;
+		}
+		else if (diff + ci < 0 && -diff > b->mean * tol / 100.0)
+			verdict = "improvement";
+		else
+			verdict = "same";
+
+		printf("%-24s %10.4g +/- %-6.2g %10.4g +/- %-6.2g %+7.1f%% %s\n", c->name,
+		       b->mean, bench_metric_ci(b), c->mean, bench_metric_ci(c),
+		       b->mean ? diff * 100.0 / b->mean : 0.0, verdict);
+	}
+	return regressions;
+}
+
+/* Saves and/or compares metrics <ms> according to BENCH_SAVE, BENCH_BASELINE
+ * and BENCH_TOLERANCE. Returns the exit status of the program: 0 if fine, 1 on
+ * error, 2 on regressions.
+ */
+static inline int bench_metrics_finish(const struct bench_metrics *ms)
+{
+	const char *save = getenv("BENCH_SAVE");
+	const char *baseline = getenv("BENCH_BASELINE");
+	const char *tol = getenv("BENCH_TOLERANCE");
+	static struct bench_metrics base;
+	int regressions;
+
+	if (save && *save && bench_metrics_save(ms, save) < 0) {
+		perror(save);
+		return 1;
+	}
+	if (!baseline || !*baseline)
+		return 0;
+	if (bench_metrics_load(&base, baseline) < 0) {
+		printf("%s: cannot load baseline.\n", baseline);
+		return 1;
+	}
+	regressions = bench_metrics_compare(ms, &base, tol ? atof(tol) : 5.0);
+	if (regressions)
+		printf("%d significant regression(s) against %s.\n", regressions, baseline);
+	return regressions ? 2 : 0;
+}
+
+/* returns the number of repetitions from BENCH_REPEAT, at least 1 */
+static inline unsigned int bench_repeat()
+{
+	const char *rep = getenv("BENCH_REPEAT");
+
+	return rep && atoi(rep) > 0 ? atoi(rep) : 1;
+}
+
+#endif /* _BENCH_H */
@@ -0,0 +1,58 @@
+/*
+ * tests/check.h
+ *
+ * Helpers shared by the unit test programs.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef _CHECK_H
+#define _CHECK_H
+
+#include <stdio.h>
+
+/* number of failed checks so far */
+static unsigned int check_failures;
+
+/* Reports a failure if <cond> is false, and continues */
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			printf("%s:%d: check failed: %s\n",		\
+			       __FILE__, __LINE__, #cond);		\
+			check_failures++;				\
+		}							\
+	} while (0)
+
+/* Reports the result of the checks, and returns the exit status */
+static inline int check_done(const char *name)
+{
+	if (check_failures) {
+		printf("%s: %u check(s) failed.\n", name, check_failures);
+		return 1;
+	}
+	printf("%s: OK\n", name);
+	return 0;
+}
+
+#endif /* _CHECK_H */
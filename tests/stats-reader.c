@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifndef MT_LIST_STATS
+#define MT_LIST_STATS
+#endif
+#include <mt_list.h>
+
+/* Reader for the statistics exported by mt_list_stats_export(). Compile this
+ * way:
+ *    cc -O2 -o stats-reader stats-reader.c -I../include
+ * It takes the name of the shared memory segment, and optionally the sampling
+ * interval in milliseconds (default 1000) and the number of samples (default
+ * 0, meaning forever):
+ * ./stats-reader /test-list.stats 500 10
+ *
+ * The segment is only mapped read-only and is never written to, so that the
+ * monitored process is not perturbed. For each sample and each list, it
+ * reports the rate of operations, the rate of retries, the fraction of time
+ * spent in back-off per second (which may exceed 100% with several threads),
+ * and the length estimate. The first sample reports the totals since start.
+ */
+
+/* Copies a consistent snapshot of <shm> of <size> bytes into <copy>. Returns
+ * 0 on success, or -1 if no consistent snapshot could be taken.
+ */
+static int snapshot(const struct mt_list_stats_shm *shm, struct mt_list_stats_shm *copy, size_t size)
+{
+	uint64_t seq;
+	int tries;
+
+	for (tries = 0; tries < 1000; tries++) {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			usleep(10);
+			continue;
+		}
+		memcpy(copy, shm, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+	return -1;
+}
+
+/* returns the total number of operations of list <st> */
+static uint64_t total_ops(const struct mt_list_stats *st)
+{
+	uint64_t total = 0;
+	unsigned int op;
+
+	for (op = 0; op < MT_LIST_TR_OPS; op++)
+		total += st->ops[op];
+	return total;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = sizeof(struct mt_list_stats_shm) + MT_LIST_STATS_MAX * sizeof(struct mt_list_stats);
+	struct mt_list_stats_shm *shm, *cur, *prev;
+	const struct mt_list_stats *c, *p;
+	unsigned int interval = 1000, count = 0, sample, i, j;
+	struct mt_list_stats none = { };
+	double secs;
+	int fd;
+
+	if (argc < 2) {
+		printf("Usage: %s <shm_name> [<interval_ms> [<count>]]\n", argv[0]);
+		exit(1);
+	}
+	if (argc > 2)
+		interval = atoi(argv[2]);
+	if (argc > 3)
+		count = atoi(argv[3]);
+
+	fd = shm_open(argv[1], O_RDONLY, 0);
+	if (fd < 0) {
+		perror(argv[1]);
+		exit(1);
+	}
+	shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	cur = calloc(1, size);
+	prev = calloc(1, size);
+	if (!cur || !prev) {
+		printf("Out of memory.\n");
+		exit(1);
+	}
+
+	for (sample = 0; !count || sample < count; sample++) {
+		if (sample)
+			usleep(interval * 1000);
+		if (snapshot(shm, cur, size) < 0) {
+			printf("%s: no consistent snapshot.\n", argv[1]);
+			exit(1);
+		}
+		if (memcmp(cur->magic, "MTLSTATS", 8) != 0 || cur->version != 1 ||
+		    cur->ops != MT_LIST_TR_OPS || cur->lists > MT_LIST_STATS_MAX) {
+			printf("%s: not a supported statistics segment.\n", argv[1]);
+			exit(1);
+		}
+
+		/* rates are computed over the period between the two updates */
+		secs = sample && cur->date_ns > prev->date_ns ? (cur->date_ns - prev->date_ns) / 1e9 : 1.0;
+		printf("\npid %u, update %llu:\n%-24s %14s %12s %10s %12s\n", cur->pid,
+		       (unsigned long long)cur->seq / 2, "list", "ops/s", "retries/s", "backoff%", "length");
+		for (i = 0; i < cur->lists; i++) {
+			c = &cur->stats[i];
+			p = &none;
+			for (j = 0; sample && j < prev->lists; j++)
+				if (strcmp(prev->stats[j].name, c->name) == 0)
+					p = &prev->stats[j];
+			printf("%-24.*s %14.0f %12.0f %10.2f %12lld\n", MT_LIST_STATS_NAME_LEN, c->name,
+			       (total_ops(c) - total_ops(p)) / secs, (c->retries - p->retries) / secs,
+			       (c->backoff_ns - p->backoff_ns) / secs / 1e7, (long long)c->length);
+		}
+		memcpy(prev, cur, size);
+	}
+	return 0;
+}
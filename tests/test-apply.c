@@ -0,0 +1,218 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mt_list.h>
+#include "check.h"
+
+/* Unit test for mt_list_apply() and mt_list_move(). Compile this way:
+ *    cc -O2 -o test-apply test-apply.c -I../include -pthread
+ * It first checks the result and the rollback of sequences of operations on a
+ * single thread, then has threads move elements between lists against each
+ * other while some of the elements are temporarily removed, and verifies that
+ * all elements end up in exactly one list.
+ */
+
+#define LISTS    4
+#define ELEMS    64
+#define THREADS  4
+#define MANY     200000
+
+struct elem {
+	struct mt_list list;
+	unsigned int seen;
+};
+
+static struct mt_list heads[LISTS];
+static struct elem elems[ELEMS];
+static unsigned long moved[THREADS], failed[THREADS];
+
+static __thread uint32_t rnd32_state = 2463534242U;
+
+/* Xorshift RNG from http://www.jstatsoft.org/v08/i14/paper */
+static inline uint32_t rnd32()
+{
+	rnd32_state ^= rnd32_state << 13;
+	rnd32_state ^= rnd32_state >> 17;
+	rnd32_state ^= rnd32_state << 5;
+	return rnd32_state;
+}
+
+/* Checks the links of all lists, marks the elements found there, and returns
+ * the number of elements which are in exactly one list.
+ */
+static unsigned int check_lists()
+{
+	struct mt_list *n;
+	unsigned int l, i, nb = 0;
+
+	for (i = 0; i < ELEMS; i++)
+		elems[i].seen = 0;
+
+	for (l = 0; l < LISTS; l++) {
+		for (n = heads[l].next; n != &heads[l]; n = n->next) {
+			CHECK(n->next->prev == n);
+			MT_LIST_ELEM(n, struct elem *, list)->seen++;
+		}
+		CHECK(heads[l].next->prev == &heads[l]);
+	}
+
+	for (i = 0; i < ELEMS; i++)
+		nb += elems[i].seen == 1;
+	return nb;
+}
+
+/* returns the list of the elements in list <lh> as a string of indexes */
+static const char *dump(struct mt_list *lh)
+{
+	static char buf[ELEMS * 4];
+	struct mt_list *n;
+	int len = 0;
+
+	buf[0] = 0;
+	for (n = lh->next; n != lh; n = n->next)
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%d", len ? "," : "",
+		                (int)(MT_LIST_ELEM(n, struct elem *, list) - elems));
+	return buf;
+}
+
+static void init_lists()
+{
+	unsigned int i;
+
+	for (i = 0; i < LISTS; i++)
+		mt_list_init(&heads[i]);
+	for (i = 0; i < ELEMS; i++)
+		mt_list_append(&heads[i % LISTS], mt_list_init(&elems[i].list));
+}
+
+static void test_single()
+{
+	struct mt_list_op ops[3];
+	unsigned int i;
+
+	for (i = 0; i < LISTS; i++)
+		mt_list_init(&heads[i]);
+	for (i = 0; i < 4; i++)
+		mt_list_append(&heads[0], mt_list_init(&elems[i].list));
+	mt_list_init(&elems[4].list);
+
+	/* moves to the end of another list, then of the same list */
+	CHECK(mt_list_move(&elems[1].list, &heads[1]));
+	CHECK(strcmp(dump(&heads[0]), "0,2,3") == 0);
+	CHECK(strcmp(dump(&heads[1]), "1") == 0);
+	CHECK(mt_list_move(&elems[0].list, &heads[0]));
+	CHECK(strcmp(dump(&heads[0]), "2,3,0") == 0);
+	CHECK(mt_list_move(&elems[0].list, &heads[0]));
+	CHECK(strcmp(dump(&heads[0]), "2,3,0") == 0);
+
+	/* a detached element is not moved */
+	CHECK(!mt_list_move(&elems[4].list, &heads[1]));
+	CHECK(!mt_list_inlist(&elems[4].list));
+	CHECK(strcmp(dump(&heads[1]), "1") == 0);
+
+	/* swap two elements between lists in a single step */
+	ops[0] = (struct mt_list_op){ .type = MT_LIST_OP_DELETE, .el = &elems[3].list };
+	ops[1] = (struct mt_list_op){ .type = MT_LIST_OP_DELETE, .el = &elems[1].list };
+	ops[2] = (struct mt_list_op){ .type = MT_LIST_OP_INSERT, .el = &elems[3].list, .pos = &heads[1] };
+	CHECK(mt_list_apply(ops, 3));
+	ops[0] = (struct mt_list_op){ .type = MT_LIST_OP_INSERT, .el = &elems[1].list, .pos = &elems[2].list };
+	ops[1] = (struct mt_list_op){ .type = MT_LIST_OP_APPEND, .el = &elems[4].list, .pos = &elems[3].list };
+	CHECK(mt_list_apply(ops, 2));
+	CHECK(strcmp(dump(&heads[0]), "2,1,0") == 0);
+	CHECK(strcmp(dump(&heads[1]), "4,3") == 0);
+
+	/* a batch in which one deletion finds its element already removed is
+	 * entirely rolled back, even after the other ones were prepared.
+	 */
+	CHECK(mt_list_delete(&elems[2].list));
+	ops[0] = (struct mt_list_op){ .type = MT_LIST_OP_DELETE, .el = &elems[0].list };
+	ops[1] = (struct mt_list_op){ .type = MT_LIST_OP_DELETE, .el = &elems[2].list };
+	ops[2] = (struct mt_list_op){ .type = MT_LIST_OP_APPEND, .el = &elems[0].list, .pos = &heads[1] };
+	CHECK(!mt_list_apply(ops, 3));
+	ops[0] = (struct mt_list_op){ .type = MT_LIST_OP_DELETE, .el = &elems[4].list };
+	ops[1] = (struct mt_list_op){ .type = MT_LIST_OP_APPEND, .el = &elems[4].list, .pos = &heads[0] };
+	ops[2] = (struct mt_list_op){ .type = MT_LIST_OP_DELETE, .el = &elems[2].list };
+	CHECK(!mt_list_apply(ops, 3));
+	CHECK(strcmp(dump(&heads[0]), "1,0") == 0);
+	CHECK(strcmp(dump(&heads[1]), "4,3") == 0);
+	CHECK(!mt_list_inlist(&elems[2].list));
+
+	/* too many operations */
+	CHECK(!mt_list_apply(ops, MT_LIST_MAX_OPS + 1));
+}
+
+/* Threads move random elements to random lists, either with mt_list_move()
+ * or by inserting them at the beginning with mt_list_apply(). Some threads
+ * also take elements out for a while with mt_list_delete() then append them
+ * again with mt_list_try_append(), so that other threads' operations on them
+ * must fail and roll back.
+ */
+static void *thread(void *arg)
+{
+	unsigned int tid = (uintptr_t)arg;
+	struct mt_list_op ops[2];
+	struct mt_list *el, *out = NULL;
+	unsigned int i;
+	long ret;
+
+	rnd32_state += tid;
+	for (i = 0; i < MANY; i++) {
+		el = &elems[rnd32() % ELEMS].list;
+
+		if ((tid & 1) && (i % 8) == 0) {
+			/* put back the element taken out, take another one. Other
+			 * threads may be trying to delete or move it meanwhile.
+			 */
+			if (out)
+				CHECK(mt_list_try_append(&heads[rnd32() % LISTS], out));
+			out = mt_list_delete(el) ? el : NULL;
+			continue;
+		}
+
+		if (rnd32() & 1)
+			ret = mt_list_move(el, &heads[rnd32() % LISTS]);
+		else {
+			ops[0] = (struct mt_list_op){ .type = MT_LIST_OP_DELETE, .el = el };
+			ops[1] = (struct mt_list_op){ .type = MT_LIST_OP_INSERT, .el = el, .pos = &heads[rnd32() % LISTS] };
+			ret = mt_list_apply(ops, 2);
+		}
+
+		if (ret)
+			moved[tid]++;
+		else
+			failed[tid]++;
+	}
+	if (out)
+		CHECK(mt_list_try_append(&heads[0], out));
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS];
+	unsigned long nbmoved = 0, nbfailed = 0;
+	unsigned int t;
+
+	init_lists();
+	CHECK(check_lists() == ELEMS);
+
+	for (t = 0; t < THREADS; t++)
+		pthread_create(&thr[t], NULL, thread, (void *)(uintptr_t)t);
+	for (t = 0; t < THREADS; t++) {
+		pthread_join(thr[t], NULL);
+		nbmoved += moved[t];
+		nbfailed += failed[t];
+	}
+
+	CHECK(check_lists() == ELEMS);
+	/* some moves must have met removed elements */
+	CHECK(nbmoved > 0 && nbfailed > 0);
+}
+
+int main(int argc, char *argv[])
+{
+	test_single();
+	test_threads();
+	return check_done("test-apply");
+}
@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mt_list_bag.h>
+#include "check.h"
+
+/* Unit test for unordered bags. Compile this way:
+ *    cc -O2 -o test-bag test-bag.c -I../include -pthread
+ * It checks that a bag is drained to empty whatever the hint used, then has
+ * several threads put and take elements at once before draining it.
+ */
+
+#define ANCHORS  4
+#define THREADS  4
+#define ELEMS    1000
+#define MANY     200000
+
+static struct mt_list anchors[ANCHORS];
+static struct mt_list_bag bag;
+static unsigned long balance[THREADS];
+
+/* returns the number of elements which are not anchors in the bag, after
+ * checking that all anchors are still linked in order.
+ */
+static unsigned int count_elems()
+{
+	struct mt_list *n;
+	unsigned int nb = 0, a = 0;
+
+	for (n = anchors[0].next; n != &anchors[0]; n = n->next) {
+		if (mt_list_bag_is_anchor(&bag, n))
+			CHECK(n == &anchors[++a]);
+		else
+			nb++;
+	}
+	CHECK(a == ANCHORS - 1);
+	return nb;
+}
+
+static void test_drain()
+{
+	struct mt_list elems[ELEMS];
+	unsigned int i, hint, nb;
+
+	for (hint = 0; hint < ANCHORS + 1; hint++) {
+		mt_list_bag_init(&bag, anchors, ANCHORS);
+		CHECK(mt_list_bag_take(&bag, hint) == NULL);
+		CHECK(count_elems() == 0);
+
+		for (i = 0; i < ELEMS; i++) {
+			mt_list_bag_put(&bag, i, mt_list_init(&elems[i]));
+			CHECK(!mt_list_bag_is_anchor(&bag, &elems[i]));
+		}
+		CHECK(count_elems() == ELEMS);
+
+		/* all elements come out from a single hint, anchors never */
+		for (nb = 0; mt_list_bag_take(&bag, hint); nb++)
+			;
+		CHECK(nb == ELEMS);
+		CHECK(count_elems() == 0);
+		CHECK(mt_list_bag_take(&bag, hint + 1) == NULL);
+	}
+}
+
+static void *thread(void *arg)
+{
+	unsigned int tid = (uintptr_t)arg;
+	struct mt_list *n;
+	unsigned int i;
+
+	for (i = 0; i < MANY; i++) {
+		if (i % 3 != 2) {
+			n = malloc(sizeof(*n));
+			mt_list_bag_put(&bag, tid, mt_list_init(n));
+			balance[tid]++;
+		}
+		else if ((n = mt_list_bag_take(&bag, tid))) {
+			free(n);
+			balance[tid]--;
+		}
+	}
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS];
+	unsigned long left = 0;
+	struct mt_list *n;
+	unsigned int t, nb;
+
+	mt_list_bag_init(&bag, anchors, ANCHORS);
+	for (t = 0; t < THREADS; t++)
+		pthread_create(&thr[t], NULL, thread, (void *)(uintptr_t)t);
+	for (t = 0; t < THREADS; t++) {
+		pthread_join(thr[t], NULL);
+		left += balance[t];
+	}
+
+	CHECK(count_elems() == left);
+	for (nb = 0; (n = mt_list_bag_take(&bag, 0)); nb++)
+		free(n);
+	CHECK(nb == left);
+	CHECK(count_elems() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	test_drain();
+	test_threads();
+	return check_done("test-bag");
+}
@@ -0,0 +1,199 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mt_list_codel.h>
+#include "check.h"
+
+/* Unit test for the sojourn-time queues. Compile this way:
+ *    cc -O2 -o test-codel test-codel.c -I../include -pthread
+ * It checks the sojourn time accounting, then has the control law enter the
+ * dropping state on a standing queue made of backdated elements, and leave it
+ * once fresh elements are dequeued. Finally several producers and consumers
+ * share a queue with a very low target, and no element may be lost.
+ */
+
+#define ELEMS    64
+#define THREADS  4
+#define MANY     100000
+
+#define MS       1000000ULL
+
+struct elem {
+	struct mt_list_codel_elem qel;
+	unsigned int idx;
+	int dropped;
+};
+
+static struct elem elems[ELEMS];
+static unsigned long produced, consumed, dropped;
+
+static void drop_cb(struct mt_list_codel *q, struct mt_list_codel_elem *el, void *ctx)
+{
+	struct elem *e = MT_LIST_ELEM(el, struct elem *, qel);
+
+	CHECK(!mt_list_inlist(&el->list));
+	e->dropped++;
+	(*(unsigned int *)ctx)++;
+}
+
+/* enqueues elements <from> to <to> excluded, with a sojourn time of <age> ns */
+static void enqueue(struct mt_list_codel *q, unsigned int from, unsigned int to, uint64_t age)
+{
+	unsigned int i;
+
+	for (i = from; i < to; i++) {
+		elems[i].idx = i;
+		elems[i].dropped = 0;
+		mt_list_codel_enqueue(q, &elems[i].qel);
+		elems[i].qel.date -= age;
+	}
+}
+
+static void test_sojourn()
+{
+	struct mt_list_codel q;
+	struct elem *e;
+	unsigned int i;
+
+	mt_list_codel_init(&q, 0, 0, NULL, NULL);
+	CHECK(mt_list_codel_dequeue(&q) == NULL);
+	CHECK(mt_list_codel_percentile(&q, 50.0) == 0);
+
+	/* 8 elements which waited about 1ms and 2 about 1s */
+	enqueue(&q, 0, 8, MS);
+	enqueue(&q, 8, 10, 1000 * MS);
+	for (i = 0; i < 10; i++) {
+		e = MT_LIST_CODEL_DEQUEUE(&q, struct elem *, qel);
+		CHECK(e && e->idx == i);
+	}
+	CHECK(mt_list_codel_dequeue(&q) == NULL);
+	CHECK(mt_list_codel_percentile(&q, 50.0) == 1ULL << 20);
+	CHECK(mt_list_codel_percentile(&q, 80.0) == 1ULL << 20);
+	CHECK(mt_list_codel_percentile(&q, 99.0) == 1ULL << 30);
+	CHECK(q.drops == 0);
+}
+
+static void test_law()
+{
+	struct mt_list_codel q;
+	struct elem *e;
+	unsigned int i, drops = 0, before;
+
+	/* a standing queue which has been waiting for 1s */
+	mt_list_codel_init(&q, 5 * MS, 10 * MS, drop_cb, &drops);
+	enqueue(&q, 0, ELEMS / 2, 1000 * MS);
+
+	/* above target, but not yet for a whole interval */
+	e = MT_LIST_CODEL_DEQUEUE(&q, struct elem *, qel);
+	CHECK(e && e->idx == 0);
+	CHECK(!q.dropping && drops == 0);
+
+	/* enter the dropping state after the interval, the first element is
+	 * dropped and the next one returned.
+	 */
+	usleep(15000);
+	e = MT_LIST_CODEL_DEQUEUE(&q, struct elem *, qel);
+	CHECK(e && e->idx == 2);
+	CHECK(elems[1].dropped == 1);
+	CHECK(q.dropping && drops == 1 && q.drops == 1);
+
+	/* the next drops happen at the pace of the control law */
+	e = MT_LIST_CODEL_DEQUEUE(&q, struct elem *, qel);
+	CHECK(e && e->idx == 3);
+	CHECK(drops == 1);
+	usleep(15000);
+	e = MT_LIST_CODEL_DEQUEUE(&q, struct elem *, qel);
+	CHECK(e && e->idx > 4);
+	CHECK(q.dropping && drops >= 2);
+	CHECK(q.count == drops);
+
+	/* fresh elements: the first one below target leaves the dropping state,
+	 * and nothing is dropped anymore.
+	 */
+	enqueue(&q, ELEMS / 2, ELEMS, 0);
+	while ((e = MT_LIST_CODEL_DEQUEUE(&q, struct elem *, qel)) && e->idx < ELEMS / 2)
+		;
+	CHECK(e && !e->dropped);
+	CHECK(!q.dropping);
+	before = drops;
+	usleep(15000);
+	while ((e = MT_LIST_CODEL_DEQUEUE(&q, struct elem *, qel)))
+		CHECK(!e->dropped);
+	CHECK(drops == before);
+
+	/* each element was either returned or dropped once */
+	for (i = 0; i < ELEMS; i++)
+		CHECK(elems[i].dropped <= 1 && !mt_list_inlist(&elems[i].qel.list));
+	CHECK(q.drops == drops);
+}
+
+static void drop_count(struct mt_list_codel *q, struct mt_list_codel_elem *el, void *ctx)
+{
+	__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+	free(el);
+}
+
+static struct mt_list_codel shared;
+static int nbprod;
+
+/* enqueues MANY elements */
+static void *producer(void *arg)
+{
+	struct mt_list_codel_elem *el;
+	unsigned int i;
+
+	for (i = 0; i < MANY; i++) {
+		el = malloc(sizeof(*el));
+		mt_list_codel_enqueue(&shared, el);
+		__atomic_add_fetch(&produced, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_sub_fetch(&nbprod, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* dequeues elements until all producers are done and the queue is empty */
+static void *consumer(void *arg)
+{
+	struct mt_list_codel_elem *el;
+
+	while (1) {
+		el = mt_list_codel_dequeue(&shared);
+		if (el) {
+			__atomic_add_fetch(&consumed, 1, __ATOMIC_RELAXED);
+			free(el);
+		}
+		else if (!__atomic_load_n(&nbprod, __ATOMIC_ACQUIRE) && mt_list_isempty(&shared.head))
+			break;
+		else
+			usleep(10);
+	}
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS];
+	unsigned int t;
+
+	/* 1us target: the law is almost always active */
+	mt_list_codel_init(&shared, 1000, 20000, drop_count, NULL);
+	nbprod = THREADS / 2;
+	for (t = 0; t < THREADS; t++)
+		pthread_create(&thr[t], NULL, (t & 1) ? consumer : producer, NULL);
+	for (t = 0; t < THREADS; t++)
+		pthread_join(thr[t], NULL);
+
+	CHECK(produced == (unsigned long)MANY * (THREADS / 2));
+	CHECK(consumed + dropped == produced);
+	CHECK(dropped > 0 && shared.drops == dropped);
+	CHECK(mt_list_isempty(&shared.head));
+}
+
+int main(int argc, char *argv[])
+{
+	test_sojourn();
+	test_law();
+	test_threads();
+	return check_done("test-codel");
+}
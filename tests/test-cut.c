@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mt_list.h>
+#include "check.h"
+
+/* Unit test for mt_list_cut() and mt_list_merge(). Compile this way:
+ *    cc -O2 -o test-cut test-cut.c -I../include -pthread
+ * It first checks the resulting lists on a single thread, then has a thread
+ * rebalance elements between shards with cut and merge while other threads
+ * delete elements and append them again, and verifies that all elements end
+ * up in exactly one shard. No thread walks over the shards meanwhile since
+ * this is not supported.
+ */
+
+#define SHARDS   4
+#define ELEMS    256
+#define THREADS  3
+#define MANY     200000
+
+struct elem {
+	struct mt_list list;
+	unsigned int seen;
+};
+
+static struct mt_list shards[SHARDS];
+static struct elem anchors[SHARDS];  /* never removed from their shard */
+static struct elem elems[ELEMS];
+static volatile int stop;
+
+static __thread uint32_t rnd32_state = 2463534242U;
+
+/* Xorshift RNG from http://www.jstatsoft.org/v08/i14/paper */
+static inline uint32_t rnd32()
+{
+	rnd32_state ^= rnd32_state << 13;
+	rnd32_state ^= rnd32_state >> 17;
+	rnd32_state ^= rnd32_state << 5;
+	return rnd32_state;
+}
+
+/* returns the list of the elements in list <lh> as a string of indexes */
+static const char *dump(struct mt_list *lh)
+{
+	static char buf[ELEMS * 4];
+	struct mt_list *n;
+	int len = 0;
+
+	buf[0] = 0;
+	for (n = lh->next; n != lh; n = n->next) {
+		CHECK(n->next->prev == n);
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%d", len ? "," : "",
+		                (int)(MT_LIST_ELEM(n, struct elem *, list) - elems));
+	}
+	return buf;
+}
+
+static void test_single()
+{
+	struct mt_list l = MT_LIST_HEAD_INIT(l);
+	struct mt_list to = MT_LIST_HEAD_INIT(to);
+	struct mt_list dst = MT_LIST_HEAD_INIT(dst);
+	unsigned int i;
+
+	for (i = 0; i < 6; i++)
+		mt_list_append(&l, mt_list_init(&elems[i].list));
+
+	/* cut after an element */
+	CHECK(mt_list_cut(&l, &elems[2].list, &to));
+	CHECK(strcmp(dump(&l), "0,1,2") == 0);
+	CHECK(strcmp(dump(&to), "3,4,5") == 0);
+
+	/* nothing after the last element: <to> is left untouched */
+	CHECK(!mt_list_cut(&l, &elems[2].list, &dst));
+	CHECK(strcmp(dump(&l), "0,1,2") == 0);
+	CHECK(mt_list_isempty(&dst));
+
+	/* merge to an empty list, then to a non-empty one */
+	CHECK(mt_list_merge(&dst, &to));
+	CHECK(mt_list_isempty(&to));
+	CHECK(strcmp(dump(&dst), "3,4,5") == 0);
+	CHECK(!mt_list_merge(&dst, &to));
+	CHECK(strcmp(dump(&dst), "3,4,5") == 0);
+
+	/* cut from the head moves everything */
+	CHECK(mt_list_cut(&l, &l, &to));
+	CHECK(mt_list_isempty(&l));
+	CHECK(strcmp(dump(&to), "0,1,2") == 0);
+	CHECK(!mt_list_cut(&l, &l, &to));
+
+	CHECK(mt_list_merge(&dst, &to));
+	CHECK(strcmp(dump(&dst), "3,4,5,0,1,2") == 0);
+
+	/* single element segments */
+	CHECK(mt_list_cut(&dst, &elems[1].list, &to));
+	CHECK(strcmp(dump(&to), "2") == 0);
+	CHECK(mt_list_merge(&l, &to));
+	CHECK(strcmp(dump(&l), "2") == 0);
+	CHECK(strcmp(dump(&dst), "3,4,5,0,1") == 0);
+}
+
+/* Moves the elements following the anchor of a random shard (which is always
+ * its first element) to the end of another one, until told to stop. Elements
+ * may be deleted while being moved, including from the temporary list.
+ */
+static void *rebalance(void *arg)
+{
+	struct mt_list tmp;
+	unsigned int from, to;
+	unsigned long moves = 0;
+
+	rnd32_state += THREADS;
+	while (!stop) {
+		from = rnd32() % SHARDS;
+		to = (from + 1 + rnd32() % (SHARDS - 1)) % SHARDS;
+		mt_list_init(&tmp);
+		if (mt_list_cut(&shards[from], &anchors[from].list, &tmp)) {
+			CHECK(mt_list_merge(&shards[to], &tmp) || mt_list_isempty(&tmp));
+			moves++;
+		}
+	}
+	*(unsigned long *)arg = moves;
+	return NULL;
+}
+
+/* deletes random elements and appends them again to random shards */
+static void *worker(void *arg)
+{
+	unsigned int tid = (uintptr_t)arg;
+	struct mt_list *el;
+	unsigned int i;
+
+	rnd32_state += tid;
+	for (i = 0; i < MANY; i++) {
+		el = &elems[rnd32() % ELEMS].list;
+		if (mt_list_delete(el))
+			mt_list_append(&shards[rnd32() % SHARDS], el);
+	}
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS], rthr;
+	unsigned long moves = 0;
+	unsigned int s, t, i, nb;
+	struct mt_list *n;
+
+	for (s = 0; s < SHARDS; s++) {
+		mt_list_init(&shards[s]);
+		mt_list_append(&shards[s], mt_list_init(&anchors[s].list));
+	}
+	for (i = 0; i < ELEMS; i++) {
+		mt_list_append(&shards[i % SHARDS], mt_list_init(&elems[i].list));
+		elems[i].seen = 0;
+	}
+
+	pthread_create(&rthr, NULL, rebalance, &moves);
+	for (t = 0; t < THREADS; t++)
+		pthread_create(&thr[t], NULL, worker, (void *)(uintptr_t)t);
+	for (t = 0; t < THREADS; t++)
+		pthread_join(thr[t], NULL);
+	stop = 1;
+	pthread_join(rthr, NULL);
+	CHECK(moves > 0);
+
+	/* each anchor must still be in its shard, and each element in one */
+	for (s = 0; s < SHARDS; s++) {
+		for (n = shards[s].next; n != &shards[s]; n = n->next) {
+			CHECK(n->next->prev == n);
+			if (n == &anchors[s].list)
+				anchors[s].seen++;
+			else if (MT_LIST_ELEM(n, struct elem *, list) >= elems &&
+			         MT_LIST_ELEM(n, struct elem *, list) < elems + ELEMS)
+				MT_LIST_ELEM(n, struct elem *, list)->seen++;
+			else
+				CHECK(!"foreign element");
+		}
+		CHECK(anchors[s].seen == 1);
+	}
+	for (nb = i = 0; i < ELEMS; i++)
+		nb += elems[i].seen == 1;
+	CHECK(nb == ELEMS);
+}
+
+int main(int argc, char *argv[])
+{
+	test_single();
+	test_threads();
+	return check_done("test-cut");
+}
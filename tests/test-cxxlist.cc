@@ -0,0 +1,178 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mt_list.hpp>
+#include "check.h"
+
+/* Unit test for the C++ container. Compile this way:
+ *    c++ -O2 -std=c++17 -o test-cxxlist test-cxxlist.cc -I../include -pthread
+ * It checks the order of the values, erase() and stale handles on a single
+ * thread, then has one thread erase the values in order while another one
+ * pops them, and verifies that each value was either erased or popped, and
+ * destroyed exactly once. Finally it destroys a list after its thread's pool.
+ */
+
+#define VALUES   1000
+#define ROUNDS   200
+
+static unsigned int destroyed[VALUES];
+
+/* a value which counts its destructions, not those of moved-from copies */
+struct value {
+	int id;
+
+	explicit value(int id) : id(id) { }
+	value(value &&v) : id(v.id) { v.id = -1; }
+	~value()
+	{
+		if (id >= 0)
+			__atomic_add_fetch(&destroyed[id], 1, __ATOMIC_RELAXED);
+	}
+};
+
+static mt::list<value> list;
+static mt::list<value>::handle handles[VALUES];
+static unsigned int erased[VALUES], popped[VALUES];
+
+static void test_single()
+{
+	mt::list<value>::handle h, old;
+
+	CHECK(list.empty());
+	CHECK(!list.pop_front());
+	CHECK(!list.erase(h));
+
+	old = list.push_back(value(1));
+	list.push_front(value(0));
+	h = list.emplace_back(2);
+	CHECK(h && h->id == 2 && (*old).id == 1);
+
+	/* erase() only succeeds once */
+	CHECK(list.erase(old));
+	CHECK(destroyed[1] == 1);
+	CHECK(!list.erase(old));
+
+	CHECK(list.pop_front()->id == 0);
+	CHECK(list.pop_front()->id == 2);
+	CHECK(!list.erase(h));
+	CHECK(!list.pop_front() && list.empty());
+
+	/* the node of a popped value is reused, its old handle must not match */
+	old = list.push_back(value(3));
+	CHECK(list.pop_front()->id == 3);
+	h = list.push_back(value(4));
+	CHECK(!list.erase(old));
+	CHECK(h->id == 4);
+	CHECK(list.erase(h));
+
+	list.push_back(value(5));
+	list.clear();
+	CHECK(destroyed[5] == 1 && list.empty());
+}
+
+/* Erases all values in the order they were added. Both threads regularly
+ * yield so that they also interleave on a single CPU.
+ */
+static void *eraser(void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < VALUES; i++) {
+		if (list.erase(handles[i]))
+			erased[i]++;
+		if (!(i % 16))
+			sched_yield();
+	}
+	return NULL;
+}
+
+/* pops values until the list is empty */
+static void *popper(void *arg)
+{
+	unsigned int i;
+
+	for (i = 0;; i++) {
+		std::optional<value> v = list.pop_front();
+
+		if (!v)
+			break;
+		popped[v->id]++;
+		if (!(i % 16))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[2];
+	unsigned long nb_erased = 0, nb_popped = 0;
+	unsigned int r, i, ok;
+
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < VALUES; i++) {
+			destroyed[i] = erased[i] = popped[i] = 0;
+			handles[i] = list.emplace_back(i);
+		}
+		pthread_create(&thr[0], NULL, eraser, NULL);
+		pthread_create(&thr[1], NULL, popper, NULL);
+		pthread_join(thr[0], NULL);
+		pthread_join(thr[1], NULL);
+
+		CHECK(list.empty());
+		for (ok = i = 0; i < VALUES; i++) {
+			ok += erased[i] + popped[i] == 1 && destroyed[i] == 1;
+			nb_erased += erased[i];
+			nb_popped += popped[i];
+		}
+		CHECK(ok == VALUES);
+
+		/* all handles are stale now */
+		for (i = 0; i < VALUES; i++)
+			CHECK(!list.erase(handles[i]));
+	}
+	/* both sides must have won some races */
+	CHECK(nb_erased > 0 && nb_popped > 0);
+}
+
+/* The list is constructed before the thread's pool, hence destroyed after it,
+ * as happens with lists with static storage at exit.
+ */
+static void *late(void *arg)
+{
+	static thread_local mt::list<value> tl;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		tl.emplace_back(i);
+	tl.pop_front();
+	return NULL;
+}
+
+static void test_late()
+{
+	pthread_t thr;
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		destroyed[i] = 0;
+	pthread_create(&thr, NULL, late, NULL);
+	pthread_join(thr, NULL);
+	for (i = 0; i < 4; i++)
+		CHECK(destroyed[i] == 1);
+
+	/* the released nodes are usable */
+	for (i = 0; i < VALUES; i++)
+		list.emplace_back(i);
+	list.clear();
+	CHECK(list.empty());
+}
+
+int main(int argc, char *argv[])
+{
+	test_single();
+	test_threads();
+	test_late();
+	return check_done("test-cxxlist");
+}
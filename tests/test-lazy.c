@@ -0,0 +1,172 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mt_list_lazy.h>
+#include "check.h"
+
+/* Unit test for the lazy deletion. Compile this way:
+ *    cc -O2 -o test-lazy test-lazy.c -I../include -pthread
+ * It checks pops, kills, walks and sweeps on a single thread, then has
+ * threads kill, pop and sweep the same elements at once, and verifies that
+ * each element was either killed then reaped once, or popped once, but never
+ * both.
+ */
+
+#define ELEMS    256
+#define ROUNDS   100
+#define THREADS  4
+
+struct elem {
+	struct mt_list_lazy_elem lel;
+	unsigned int killed;
+	unsigned int reaped;
+	unsigned int popped;
+};
+
+static struct elem elems[ELEMS];
+static struct mt_list_lazy ll;
+
+static __thread uint32_t rnd32_state = 2463534242U;
+
+/* Xorshift RNG from http://www.jstatsoft.org/v08/i14/paper */
+static inline uint32_t rnd32()
+{
+	rnd32_state ^= rnd32_state << 13;
+	rnd32_state ^= rnd32_state >> 17;
+	rnd32_state ^= rnd32_state << 5;
+	return rnd32_state;
+}
+
+static void reap(struct mt_list_lazy *l, struct mt_list_lazy_elem *el, void *ctx)
+{
+	struct elem *e = MT_LIST_ELEM(el, struct elem *, lel);
+
+	CHECK(l == &ll && ctx == &elems);
+	__atomic_add_fetch(&e->reaped, 1, __ATOMIC_RELAXED);
+}
+
+/* resets the list, then appends the <nb> first elements */
+static void fill(unsigned int nb)
+{
+	unsigned int i;
+
+	mt_list_lazy_init(&ll, reap, &elems);
+	for (i = 0; i < ELEMS; i++) {
+		mt_list_lazy_elem_init(&elems[i].lel);
+		elems[i].killed = elems[i].reaped = elems[i].popped = 0;
+		if (i < nb)
+			mt_list_lazy_append(&ll, &elems[i].lel);
+	}
+}
+
+/* foreach callback: kills element 1, counts the live ones */
+static int visit(struct mt_list_lazy_elem *el, void *ctx)
+{
+	CHECK(!mt_list_lazy_isdead(el));
+	(*(unsigned int *)ctx)++;
+	if (el == &elems[1].lel)
+		CHECK(mt_list_lazy_kill(el));
+	return MT_LIST_FE_CONT;
+}
+
+static void test_single()
+{
+	unsigned int live = 0;
+
+	fill(4);
+	CHECK(!mt_list_lazy_kill(&elems[4].lel));
+
+	/* a killed element is skipped and reaped by the next pop */
+	CHECK(mt_list_lazy_kill(&elems[1].lel));
+	CHECK(!mt_list_lazy_kill(&elems[1].lel));
+	CHECK(mt_list_lazy_isdead(&elems[1].lel));
+	CHECK(MT_LIST_LAZY_POP(&ll, struct elem *, lel) == &elems[0]);
+	CHECK(!elems[1].reaped);
+	CHECK(MT_LIST_LAZY_POP(&ll, struct elem *, lel) == &elems[2]);
+	CHECK(elems[1].reaped == 1);
+
+	/* a popped element cannot be killed */
+	CHECK(!mt_list_lazy_kill(&elems[0].lel));
+	CHECK(!mt_list_lazy_isdead(&elems[0].lel));
+
+	/* sweep */
+	CHECK(mt_list_lazy_kill(&elems[3].lel));
+	CHECK(mt_list_lazy_sweep(&ll) == 1);
+	CHECK(elems[3].reaped == 1);
+	CHECK(mt_list_isempty(&ll.head));
+	CHECK(mt_list_lazy_pop(&ll) == NULL);
+
+	/* walk: dead elements are reaped, the callback may kill */
+	fill(4);
+	CHECK(mt_list_lazy_kill(&elems[2].lel));
+	CHECK(mt_list_lazy_foreach(&ll, visit, &live, 0) == 4);
+	CHECK(live == 3);
+	CHECK(elems[1].reaped == 1 && elems[2].reaped == 1);
+	CHECK(MT_LIST_LAZY_POP(&ll, struct elem *, lel) == &elems[0]);
+	CHECK(MT_LIST_LAZY_POP(&ll, struct elem *, lel) == &elems[3]);
+	CHECK(mt_list_lazy_pop(&ll) == NULL);
+}
+
+/* Threads randomly kill random elements, pop elements and rarely sweep the
+ * list, until all elements were taken out. Sweeps are kept rare because a
+ * sweeper preempted in the middle of the list stalls everyone on small
+ * machines.
+ */
+static void *thread(void *arg)
+{
+	unsigned int tid = (uintptr_t)arg;
+	struct elem *e;
+	unsigned int r;
+
+	rnd32_state += tid;
+	while (!mt_list_isempty(&ll.head)) {
+		r = rnd32() % 256;
+		if (r < 128) {
+			e = &elems[rnd32() % ELEMS];
+			if (mt_list_lazy_kill(&e->lel))
+				__atomic_add_fetch(&e->killed, 1, __ATOMIC_RELAXED);
+		}
+		else if (r < 255) {
+			e = MT_LIST_LAZY_POP(&ll, struct elem *, lel);
+			if (e)
+				__atomic_add_fetch(&e->popped, 1, __ATOMIC_RELAXED);
+		}
+		else
+			mt_list_lazy_sweep(&ll);
+	}
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS];
+	unsigned long killed = 0, popped = 0;
+	unsigned int r, t, i, ok;
+
+	for (r = 0; r < ROUNDS; r++) {
+		fill(ELEMS);
+		for (t = 0; t < THREADS; t++)
+			pthread_create(&thr[t], NULL, thread, (void *)(uintptr_t)(r * THREADS + t));
+		for (t = 0; t < THREADS; t++)
+			pthread_join(thr[t], NULL);
+
+		for (ok = i = 0; i < ELEMS; i++) {
+			if (elems[i].killed)
+				ok += elems[i].killed == 1 && elems[i].reaped == 1 && !elems[i].popped;
+			else
+				ok += !elems[i].reaped && elems[i].popped == 1;
+			killed += elems[i].killed;
+			popped += elems[i].popped;
+		}
+		CHECK(ok == ELEMS);
+	}
+	/* both sides must have won some races */
+	CHECK(killed > 0 && popped > 0);
+}
+
+int main(int argc, char *argv[])
+{
+	test_single();
+	test_threads();
+	return check_done("test-lazy");
+}
@@ -3,11 +3,22 @@
 #include <stdlib.h>
 #define USE_THREAD
 #include <mt_list.h>
+#include "bench.h"
 
 /* Stress test for mt_lists. Compile this way:
  *    cc -O2 -o test-list test-list.c -I../include -pthread
  * The only argument it takes is the number of threads to be used.
  * ./test-list 4
+ * When built with -DMT_LIST_TRACE, the last operations of each thread are
+ * dumped into test-list.trace, which may be analysed using trace-decode.
+ * When built with -DMT_LIST_DELAY, delays may be injected inside the critical
+ * sections using the BENCH_DELAY environment variable (see bench.h), e.g.:
+ * BENCH_DELAY=exp:1000:10 ./test-list 4
+ * When built with -DMT_LIST_STATS, the list's statistics are exported into
+ * shared memory segment "/test-list.stats" during the test, which may be
+ * watched using stats-reader.
+ * When built with -DMT_LIST_HOLD, the lock hold times are reported at the end,
+ * after checking that no hold remains tracked.
  */
 
 struct mt_list pouet_list = MT_LIST_HEAD_INIT(pouet_list);
@@ -32,6 +43,26 @@ static inline uint32_t rnd32()
         return rnd32_state;
 }
 
+/* pop_if() predicate: accepts roughly half of the elements */
+long accept_some(struct mt_list *el, void *ctx)
+{
+	return !!((uintptr_t)el & 0x10);
+}
+
+/* mt_list_foreach() callback: randomly removes elements and stops */
+int visit_some(struct mt_list *el, void *ctx)
+{
+	int ret = MT_LIST_FE_CONT;
+
+	if (rnd32() % 2) {
+		free(MT_LIST_ELEM(el, struct pouet_lol *, list_elt));
+		ret |= MT_LIST_FE_REMOVE;
+	}
+	if (rnd32() % 2)
+		ret |= MT_LIST_FE_STOP;
+	return ret;
+}
+
 void *thread(void *pouet)
 {
 	struct pouet_lol *lol;
@@ -42,7 +73,7 @@ void *thread(void *pouet)
 	rnd32_state += tid;
 
 	for (i = 0; i < MAX_ACTION; i++) {
-		switch (rnd32() % 4) {
+		switch (rnd32() % 6) {
 		case 0:
 			lol = malloc(sizeof(*lol));
 			MT_LIST_INIT(&lol->list_elt);
@@ -70,15 +101,56 @@ void *thread(void *pouet)
 				}
 			}
 			break;
+		case 4:
+			lol = MT_LIST_POP_IF(&pouet_list, struct pouet_lol *, list_elt, accept_some, NULL);
+			if (lol)
+				free(lol);
+			break;
+		case 5:
+			mt_list_foreach(&pouet_list, visit_some, NULL, (rnd32() % 2) ? MT_LIST_FE_UNLOCKED : 0);
+			break;
 		default:
 			break;
 		}
 		if ((i) / (MAX_ACTION/10) != (i+1) / (MAX_ACTION/10))
 			printf("%u: %d\n", tid, i+1);
+#if defined(MT_LIST_STATS)
+		if (tid == 0 && (i % 100000) == 0)
+			mt_list_stats_publish();
+#endif
 	}
 	return NULL;
 }
 
+#if defined(MT_LIST_HOLD)
+/* mt_list_sort() comparison function: orders elements by address */
+int cmp_addr(const struct mt_list *a, const struct mt_list *b)
+{
+	return (a > b) - (a < b);
+}
+
+/* Checks that the functions which lock a link then rewrite it by hand end
+ * their hold, otherwise the thread's tracking slots would leak.
+ */
+void check_holds()
+{
+	struct mt_list own = MT_LIST_HEAD_INIT(own);
+	struct pouet_lol *lol;
+	int i;
+
+	for (i = 0; i < 2 * MT_LIST_HOLD_DEPTH; i++) {
+		lol = malloc(sizeof(*lol));
+		mt_list_own_append(&own, mt_list_init(&lol->list_elt));
+		mt_list_own_publish(&pouet_list, &own);
+		mt_list_sort(&pouet_list, cmp_addr, 1);
+	}
+	if (_mt_list_hold_nbcur != 0) {
+		printf("%u hold slots leaked.\n", _mt_list_hold_nbcur);
+		exit(1);
+	}
+}
+#endif
+
 int main(int argc, char *argv[])
 {
 	int nb, i;
@@ -90,6 +162,13 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	nb = atoi(argv[1]);
+	if (bench_delay_init() < 0)
+		exit(1);
+#if defined(MT_LIST_STATS)
+	mt_list_stats_register(&pouet_list, "pouet_list");
+	if (mt_list_stats_export("/test-list.stats") < 0)
+		perror("/test-list.stats");
+#endif
 #if 0
 	if (nb < 2) {
 		printf("Need at least 2 threads.\n");
@@ -107,5 +186,17 @@ int main(int argc, char *argv[])
 	}
 	for (i = 0; i < nb; i++)
 		pthread_join(pth[i], NULL);
+#if defined(MT_LIST_TRACE)
+	if (mt_list_trace_dump("test-list.trace") < 0)
+		perror("test-list.trace");
+#endif
+#if defined(MT_LIST_HOLD)
+	check_holds();
+	mt_list_hold_dump(stdout);
+#endif
+#if defined(MT_LIST_STATS)
+	mt_list_stats_publish();
+	shm_unlink("/test-list.stats");
+#endif
 	return 0;
 }
@@ -0,0 +1,145 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mt_list_mbox.h>
+#include "check.h"
+
+/* Unit test for the mailboxes. Compile this way:
+ *    cc -O2 -o test-mbox test-mbox.c -I../include -pthread
+ * It checks the order of the messages and the notifications on a single
+ * thread, then has several threads send numbered messages to an owner which
+ * only waits for notifications once its mailbox is empty, and verifies that
+ * each sender's messages are received in order and that none is lost.
+ */
+
+#define SENDERS  3
+#define MANY     100000
+
+struct msg {
+	struct mt_list list;
+	unsigned int sender;
+	unsigned int seq;
+};
+
+static struct mt_list_mbox mbox;
+static unsigned int wakes;
+static int notified;
+
+/* wake callback: sticky notification */
+static void wake(struct mt_list_mbox *mb, void *ctx)
+{
+	CHECK(mb == &mbox && ctx == &notified);
+	__atomic_add_fetch(&wakes, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&notified, 1, __ATOMIC_RELEASE);
+}
+
+static void test_single()
+{
+	struct msg msgs[5];
+	struct msg *m;
+	unsigned int i;
+
+	mt_list_mbox_init(&mbox, wake, &notified);
+	CHECK(mt_list_mbox_recv(&mbox) == NULL);
+	CHECK(!mt_list_mbox_fetch(&mbox));
+
+	for (i = 0; i < 5; i++) {
+		msgs[i].seq = i;
+		mt_list_init(&msgs[i].list);
+	}
+
+	/* only the first message of a batch notifies */
+	CHECK(mt_list_mbox_send(&mbox, &msgs[0].list));
+	CHECK(!mt_list_mbox_send(&mbox, &msgs[1].list));
+	CHECK(wakes == 1 && notified);
+
+	/* fetched messages do not count, order is preserved across fetches */
+	CHECK(mt_list_mbox_fetch(&mbox));
+	CHECK(mt_list_isempty(&mbox.head));
+	CHECK(mt_list_mbox_send(&mbox, &msgs[2].list));
+	CHECK(!mt_list_mbox_send(&mbox, &msgs[3].list));
+	CHECK(wakes == 2);
+	for (i = 0; i < 3; i++) {
+		m = MT_LIST_MBOX_RECV(&mbox, struct msg *, list);
+		CHECK(m == &msgs[i]);
+		CHECK(!mt_list_inlist(&m->list));
+	}
+	CHECK(mt_list_mbox_send(&mbox, &msgs[4].list));
+	CHECK(MT_LIST_MBOX_RECV(&mbox, struct msg *, list) == &msgs[3]);
+	CHECK(MT_LIST_MBOX_RECV(&mbox, struct msg *, list) == &msgs[4]);
+	CHECK(mt_list_mbox_recv(&mbox) == NULL);
+	CHECK(wakes == 3);
+
+	/* no callback */
+	mt_list_mbox_init(&mbox, NULL, NULL);
+	CHECK(mt_list_mbox_send(&mbox, mt_list_init(&msgs[0].list)));
+	CHECK(wakes == 3);
+	CHECK(mt_list_mbox_recv(&mbox) == &msgs[0].list);
+}
+
+/* sends MANY numbered messages */
+static void *sender(void *arg)
+{
+	unsigned int tid = (uintptr_t)arg;
+	struct msg *m;
+	unsigned int i;
+
+	for (i = 0; i < MANY; i++) {
+		m = malloc(sizeof(*m));
+		m->sender = tid;
+		m->seq = i;
+		mt_list_mbox_send(&mbox, mt_list_init(&m->list));
+	}
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[SENDERS];
+	unsigned int next[SENDERS] = { 0 };
+	unsigned long received = 0;
+	struct msg *m;
+	unsigned int t, wait;
+
+	mt_list_mbox_init(&mbox, wake, &notified);
+	wakes = notified = 0;
+	for (t = 0; t < SENDERS; t++)
+		pthread_create(&thr[t], NULL, sender, (void *)(uintptr_t)t);
+
+	while (received < (unsigned long)SENDERS * MANY) {
+		while ((m = MT_LIST_MBOX_RECV(&mbox, struct msg *, list))) {
+			CHECK(m->sender < SENDERS);
+			CHECK(m->seq == next[m->sender]);
+			next[m->sender] = m->seq + 1;
+			received++;
+			free(m);
+		}
+		if (received == (unsigned long)SENDERS * MANY)
+			break;
+
+		/* the mailbox is empty, the next message must notify us */
+		for (wait = 0; !__atomic_exchange_n(&notified, 0, __ATOMIC_ACQUIRE); wait++) {
+			if (wait == 100000) {
+				CHECK(!"lost notification");
+				goto out;
+			}
+			usleep(1);
+		}
+	}
+ out:
+	for (t = 0; t < SENDERS; t++)
+		pthread_join(thr[t], NULL);
+
+	for (t = 0; t < SENDERS; t++)
+		CHECK(next[t] == MANY);
+	CHECK(wakes > 0 && wakes <= received);
+	CHECK(mt_list_mbox_recv(&mbox) == NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	test_single();
+	test_threads();
+	return check_done("test-mbox");
+}
@@ -0,0 +1,187 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <mt_list_mq.h>
+#include "check.h"
+
+/* Unit test for the multi-queue consumer. Compile this way:
+ *    cc -O2 -o test-mq test-mq.c -I../include -pthread
+ * It checks the strict priority and weighted round-robin policies on a single
+ * consumer, then has several consumers drain the same queues at once.
+ */
+
+#define NBQ      3
+#define PER_Q    60
+#define THREADS  4
+#define MANY     100000
+
+struct elem {
+	struct mt_list list;
+	unsigned int q;
+};
+
+static struct mt_list heads[NBQ];
+static struct mt_list *hptr[NBQ] = { &heads[0], &heads[1], &heads[2] };
+static struct elem elems[NBQ][PER_Q];
+
+/* resets the queues, then fills queue <q> with <nb[q]> elements */
+static void fill(const unsigned int *nb)
+{
+	unsigned int q, i;
+
+	for (q = 0; q < NBQ; q++) {
+		mt_list_init(&heads[q]);
+		for (i = 0; i < nb[q]; i++) {
+			elems[q][i].q = q;
+			mt_list_append(&heads[q], mt_list_init(&elems[q][i].list));
+		}
+	}
+}
+
+static void test_strict()
+{
+	static const unsigned int nb[NBQ] = { 5, 0, 5 };
+	struct mt_list_mq mq;
+	struct elem *e;
+	unsigned int i;
+
+	fill(nb);
+	mt_list_mq_init(&mq, hptr, NULL, NBQ);
+	for (i = 0; i < 10; i++) {
+		e = MT_LIST_MQ_POP(&mq, struct elem *, list);
+		CHECK(e != NULL);
+		if (!e)
+			return;
+		/* all of queue 0 comes first, queue 1 is empty */
+		CHECK(e->q == (i < 5 ? 0 : 2));
+		CHECK(mq.last == e->q);
+	}
+	CHECK(mt_list_mq_pop(&mq) == NULL);
+
+	/* a higher priority element preempts the remaining ones */
+	fill(nb);
+	CHECK(mt_list_mq_pop(&mq) != NULL && mq.last == 0);
+	while (mt_list_pop(&heads[0]))
+		;
+	CHECK(mt_list_mq_pop(&mq) != NULL && mq.last == 2);
+	mt_list_append(&heads[1], mt_list_init(&elems[1][0].list));
+	CHECK(mt_list_mq_pop(&mq) == &elems[1][0].list && mq.last == 1);
+}
+
+static void test_wrr()
+{
+	static const unsigned int nb[NBQ] = { PER_Q, PER_Q, PER_Q };
+	static const unsigned int skip[NBQ] = { 4, 0, PER_Q };
+	static const unsigned int weights[NBQ] = { 3, 2, 1 };
+	static const unsigned int zero[NBQ] = { 2, 0, 1 };
+	static const unsigned int pattern[6] = { 0, 0, 0, 1, 1, 2 };
+	unsigned int count[NBQ] = { 0 };
+	struct mt_list_mq mq;
+	struct elem *e;
+	unsigned int i;
+
+	/* queues are served 3:2:1 in this exact order while all are busy */
+	fill(nb);
+	mt_list_mq_init(&mq, hptr, weights, NBQ);
+	for (i = 0; i < 6 * (PER_Q / 3); i++) {
+		e = MT_LIST_MQ_POP(&mq, struct elem *, list);
+		CHECK(e != NULL);
+		if (!e)
+			return;
+		CHECK(e->q == pattern[i % 6]);
+		count[e->q]++;
+	}
+	CHECK(count[0] == PER_Q && count[1] == 2 * PER_Q / 3 && count[2] == PER_Q / 3);
+
+	/* once queue 0 is drained, the others share the consumer 2:1 */
+	for (i = 0; i < 12; i++) {
+		e = MT_LIST_MQ_POP(&mq, struct elem *, list);
+		CHECK(e != NULL && e->q == (i % 3 < 2 ? 1 : 2));
+	}
+
+	/* a zero weight disables a queue */
+	fill(nb);
+	mt_list_mq_init(&mq, hptr, zero, NBQ);
+	for (i = 0; i < 2 * PER_Q; i++) {
+		e = MT_LIST_MQ_POP(&mq, struct elem *, list);
+		CHECK(e != NULL && e->q != 1);
+	}
+	CHECK(mt_list_mq_pop(&mq) == NULL);
+	CHECK(!mt_list_isempty(&heads[1]));
+
+	/* an empty queue forfeits its credit: with queue 1 empty and only 4
+	 * elements in queue 0, queue 2 gets the rest of the time.
+	 */
+	fill(skip);
+	mt_list_mq_init(&mq, hptr, weights, NBQ);
+	for (i = 0; i < NBQ; i++)
+		count[i] = 0;
+	for (i = 0; i < 10; i++) {
+		e = MT_LIST_MQ_POP(&mq, struct elem *, list);
+		CHECK(e != NULL);
+		if (e)
+			count[e->q]++;
+	}
+	CHECK(count[0] == 4 && count[1] == 0 && count[2] == 6);
+}
+
+/* several consumers drain the same queues, while producers refill them */
+static struct mt_list_mq consumers[THREADS];
+static unsigned long popped[THREADS];
+static unsigned long pushed[THREADS];
+
+static void *thread(void *arg)
+{
+	static const unsigned int weights[NBQ] = { 4, 2, 1 };
+	unsigned int tid = (uintptr_t)arg;
+	struct mt_list *n;
+	unsigned int i;
+
+	mt_list_mq_init(&consumers[tid], hptr, weights, NBQ);
+	for (i = 0; i < MANY; i++) {
+		if (i & 1) {
+			n = malloc(sizeof(*n));
+			mt_list_append(&heads[(i + tid) % NBQ], mt_list_init(n));
+			pushed[tid]++;
+		}
+		else if ((n = mt_list_mq_pop(&consumers[tid]))) {
+			free(n);
+			popped[tid]++;
+		}
+	}
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS];
+	unsigned long nbpush = 0, nbpop = 0;
+	struct mt_list_mq mq;
+	struct mt_list *n;
+	unsigned int t;
+
+	for (t = 0; t < NBQ; t++)
+		mt_list_init(&heads[t]);
+	for (t = 0; t < THREADS; t++)
+		pthread_create(&thr[t], NULL, thread, (void *)(uintptr_t)t);
+	for (t = 0; t < THREADS; t++) {
+		pthread_join(thr[t], NULL);
+		nbpush += pushed[t];
+		nbpop += popped[t];
+	}
+
+	mt_list_mq_init(&mq, hptr, NULL, NBQ);
+	while ((n = mt_list_mq_pop(&mq))) {
+		free(n);
+		nbpop++;
+	}
+	CHECK(nbpop == nbpush);
+}
+
+int main(int argc, char *argv[])
+{
+	test_strict();
+	test_wrr();
+	test_threads();
+	return check_done("test-mq");
+}
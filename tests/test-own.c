@@ -0,0 +1,168 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mt_list.h>
+#include "check.h"
+
+/* Unit test for the owned list API. Compile this way:
+ *    cc -O2 -o test-own test-own.c -I../include -pthread
+ * It checks the owned operations and iterators on a local list, then has
+ * threads take the whole shared list with mt_list_behead(), attach it to a
+ * local head, work on it privately and publish it back, while other threads
+ * append elements, and verifies that no element is lost.
+ */
+
+#define ELEMS    16
+#define THREADS  4
+#define MANY     100000
+
+struct elem {
+	struct mt_list list;
+	unsigned int val;
+};
+
+static struct elem elems[ELEMS];
+static struct mt_list shared = MT_LIST_HEAD_INIT(shared);
+static unsigned long added[THREADS];
+
+/* returns the list of the values in list <lh> */
+static const char *dump(struct mt_list *lh)
+{
+	static char buf[ELEMS * 4];
+	struct elem *e;
+	int len = 0;
+
+	buf[0] = 0;
+	MT_LIST_OWN_FOR_EACH_ENTRY(e, lh, list) {
+		CHECK(e->list.next->prev == &e->list);
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%u", len ? "," : "", e->val);
+	}
+	return buf;
+}
+
+static void test_single()
+{
+	struct mt_list local = MT_LIST_HEAD_INIT(local);
+	struct mt_list *first;
+	struct elem *e, *back;
+	unsigned int i;
+
+	for (i = 0; i < ELEMS; i++) {
+		elems[i].val = i;
+		mt_list_init(&elems[i].list);
+	}
+
+	/* insert, append, delete and pop */
+	CHECK(mt_list_own_pop(&local) == NULL);
+	mt_list_own_append(&local, &elems[1].list);
+	mt_list_own_append(&local, &elems[2].list);
+	mt_list_own_insert(&local, &elems[0].list);
+	mt_list_own_insert(&elems[2].list, &elems[3].list);
+	mt_list_own_append(&elems[3].list, &elems[4].list);
+	CHECK(strcmp(dump(&local), "0,1,2,4,3") == 0);
+	CHECK(mt_list_own_delete(&elems[2].list));
+	CHECK(!mt_list_own_delete(&elems[2].list));
+	CHECK(!mt_list_inlist(&elems[2].list));
+	CHECK(MT_LIST_OWN_POP(&local, struct elem *, list) == &elems[0]);
+	CHECK(!mt_list_inlist(&elems[0].list));
+	CHECK(strcmp(dump(&local), "1,4,3") == 0);
+
+	/* removal and moves while iterating */
+	MT_LIST_OWN_FOR_EACH_ENTRY_SAFE(e, back, &local, list) {
+		mt_list_own_delete(&e->list);
+		if (e->val != 4)
+			mt_list_own_insert(&local, &e->list);
+	}
+	CHECK(strcmp(dump(&local), "3,1") == 0);
+	CHECK(!mt_list_inlist(&elems[4].list));
+
+	/* publish to an empty list, then to a non-empty one */
+	CHECK(mt_list_own_publish(&shared, &local));
+	CHECK(mt_list_isempty(&local));
+	CHECK(!mt_list_own_publish(&shared, &local));
+	mt_list_own_append(&local, &elems[5].list);
+	mt_list_own_append(&local, &elems[6].list);
+	CHECK(mt_list_own_publish(&shared, &local));
+	CHECK(strcmp(dump(&shared), "3,1,5,6") == 0);
+
+	/* attach what mt_list_behead() returns */
+	first = mt_list_behead(&shared);
+	CHECK(first == &elems[3].list);
+	CHECK(mt_list_isempty(&shared));
+	CHECK(mt_list_own_attach(&local, first) == &local);
+	CHECK(strcmp(dump(&local), "3,1,5,6") == 0);
+	CHECK(local.prev == &elems[6].list);
+
+	/* an empty result gives an empty list */
+	CHECK(mt_list_behead(&shared) == NULL);
+	CHECK(mt_list_own_attach(&local, mt_list_behead(&shared)) == &local);
+	CHECK(mt_list_isempty(&local));
+}
+
+/* Odd threads append new elements. Even threads take the whole shared list,
+ * drop one element in two and publish the rest back in reverse order.
+ */
+static void *thread(void *arg)
+{
+	struct mt_list local, rev;
+	unsigned int tid = (uintptr_t)arg;
+	struct elem *e, *back;
+	unsigned int i, n;
+	long balance = 0;
+
+	for (i = 0; i < MANY; i++) {
+		if (tid & 1) {
+			e = malloc(sizeof(*e));
+			mt_list_try_append(&shared, mt_list_init(&e->list));
+			balance++;
+			continue;
+		}
+
+		if (i % 16)
+			continue;
+
+		mt_list_own_attach(&local, mt_list_behead(&shared));
+		mt_list_init(&rev);
+		n = 0;
+		MT_LIST_OWN_FOR_EACH_ENTRY_SAFE(e, back, &local, list) {
+			mt_list_own_delete(&e->list);
+			if (n++ & 1) {
+				free(e);
+				balance--;
+			}
+			else
+				mt_list_own_insert(&rev, &e->list);
+		}
+		CHECK(mt_list_isempty(&local));
+		mt_list_own_publish(&shared, &rev);
+	}
+	added[tid] = balance;
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS];
+	long balance = 0;
+	unsigned int t, n;
+	struct mt_list *el;
+
+	for (t = 0; t < THREADS; t++)
+		pthread_create(&thr[t], NULL, thread, (void *)(uintptr_t)t);
+	for (t = 0; t < THREADS; t++) {
+		pthread_join(thr[t], NULL);
+		balance += added[t];
+	}
+
+	for (n = 0; (el = mt_list_pop(&shared)); n++)
+		free(el);
+	CHECK(n == balance);
+}
+
+int main(int argc, char *argv[])
+{
+	test_single();
+	test_threads();
+	return check_done("test-own");
+}
@@ -0,0 +1,239 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mt_list.h>
+#include "check.h"
+
+/* Unit test for mt_list_snapshot(). Compile this way:
+ *    cc -O2 -o test-snapshot test-snapshot.c -I../include -pthread
+ * It checks the collected references on a single thread, then that a pop may
+ * only complete during a walk in relaxed mode, and finally takes snapshots of
+ * a FIFO fed and consumed by other threads in both modes, which must always
+ * be an ordered run of consecutive elements.
+ */
+
+#define MAX      64
+#define THREADS  2
+#define MANY     100000
+
+struct obj {
+	struct mt_list list;
+	unsigned int refs;
+	unsigned int seq;
+	int dying;
+};
+
+static struct mt_list fifo = MT_LIST_HEAD_INIT(fifo);
+static unsigned int next_seq;
+static volatile int stop, go, popped;
+
+/* snapshot callback: takes a reference on live objects */
+static void *getref(struct mt_list *el, void *ctx)
+{
+	struct obj *obj = MT_LIST_ELEM(el, struct obj *, list);
+
+	if (obj->dying)
+		return NULL;
+	__atomic_add_fetch(&obj->refs, 1, __ATOMIC_RELAXED);
+	return obj;
+}
+
+static void putref(struct obj *obj)
+{
+	if (!__atomic_sub_fetch(&obj->refs, 1, __ATOMIC_ACQ_REL))
+		free(obj);
+}
+
+static struct obj *new_obj()
+{
+	struct obj *obj = calloc(1, sizeof(*obj));
+
+	mt_list_init(&obj->list);
+	obj->refs = 1;   /* the list's */
+	return obj;
+}
+
+static void test_single()
+{
+	struct obj *objs[10], *tab[MAX];
+	unsigned int i, nb;
+	int flags;
+
+	for (flags = 0; flags <= MT_LIST_SNAP_STRICT; flags += MT_LIST_SNAP_STRICT) {
+		CHECK(mt_list_snapshot(&fifo, (void **)tab, MAX, getref, NULL, flags) == 0);
+		CHECK(mt_list_isempty(&fifo));
+
+		for (i = 0; i < 10; i++) {
+			objs[i] = new_obj();
+			objs[i]->seq = i;
+			objs[i]->dying = (i == 3 || i == 7);
+			mt_list_append(&fifo, &objs[i]->list);
+		}
+
+		/* dying objects are skipped, the others are referenced */
+		nb = mt_list_snapshot(&fifo, (void **)tab, MAX, getref, NULL, flags);
+		CHECK(nb == 8);
+		for (i = 0; i < nb; i++) {
+			CHECK(tab[i]->seq == i + (i >= 3) + (i >= 6));
+			CHECK(tab[i]->refs == 2);
+			putref(tab[i]);
+		}
+
+		/* at most <max> references, and the list is left usable */
+		nb = mt_list_snapshot(&fifo, (void **)tab, 4, getref, NULL, flags);
+		CHECK(nb == 4);
+		CHECK(tab[3]->seq == 4);
+		for (i = 0; i < nb; i++)
+			putref(tab[i]);
+		nb = mt_list_snapshot(&fifo, (void **)tab, 1, getref, NULL, flags);
+		CHECK(nb == 1 && tab[0]->seq == 0);
+		putref(tab[0]);
+
+		for (i = 0; i < 10; i++) {
+			CHECK(mt_list_pop(&fifo) == &objs[i]->list);
+			CHECK(objs[i]->refs == 1);
+			putref(objs[i]);
+		}
+		CHECK(mt_list_pop(&fifo) == NULL);
+	}
+}
+
+/* snapshot callback: on the third element, lets the popper try to pop the
+ * first one and waits up to 300ms for it to succeed.
+ */
+static void *getref_wait(struct mt_list *el, void *ctx)
+{
+	unsigned int *count = ctx;
+	int i;
+
+	if (++*count == 3) {
+		go = 1;
+		for (i = 0; i < 300 && !popped; i++)
+			usleep(1000);
+	}
+	return getref(el, NULL);
+}
+
+static void *popper(void *arg)
+{
+	struct mt_list *n;
+
+	while (!go)
+		usleep(100);
+	n = mt_list_pop(&fifo);
+	popped = 1;
+	if (n)
+		putref(MT_LIST_ELEM(n, struct obj *, list));
+	return NULL;
+}
+
+static void test_strict()
+{
+	struct obj *tab[MAX];
+	struct mt_list *n;
+	unsigned int i, nb, count;
+	int flags, during;
+	pthread_t thr;
+
+	for (flags = 0; flags <= MT_LIST_SNAP_STRICT; flags += MT_LIST_SNAP_STRICT) {
+		for (i = 0; i < 5; i++)
+			mt_list_append(&fifo, &new_obj()->list);
+
+		go = popped = 0;
+		count = 0;
+		pthread_create(&thr, NULL, popper, NULL);
+		nb = mt_list_snapshot(&fifo, (void **)tab, MAX, getref_wait, &count, flags);
+		during = popped;
+		pthread_join(thr, NULL);
+
+		/* the walk started before the pop in both cases */
+		CHECK(nb == 5);
+		if (flags & MT_LIST_SNAP_STRICT)
+			CHECK(!during);
+		else
+			CHECK(during);
+		CHECK(popped);
+
+		for (i = 0; i < nb; i++)
+			putref(tab[i]);
+		while ((n = mt_list_pop(&fifo)))
+			putref(MT_LIST_ELEM(n, struct obj *, list));
+	}
+}
+
+/* appends objects with increasing sequence numbers, and pops them */
+static void *feeder(void *arg)
+{
+	unsigned int tid = (uintptr_t)arg;
+	struct mt_list *n;
+	struct obj *obj;
+	unsigned int i;
+
+	for (i = 0; i < MANY; i++) {
+		if (tid == 0) {
+			if ((i & 1) == 0) {
+				/* single producer so that the FIFO is ordered */
+				obj = new_obj();
+				obj->seq = ++next_seq;
+				mt_list_append(&fifo, &obj->list);
+				continue;
+			}
+		}
+		if ((n = mt_list_pop(&fifo)))
+			putref(MT_LIST_ELEM(n, struct obj *, list));
+	}
+	return NULL;
+}
+
+static void *walker(void *arg)
+{
+	int flags = (uintptr_t)arg;
+	struct obj *tab[MAX];
+	unsigned int i, nb;
+	unsigned long walks = 0;
+
+	while (!stop) {
+		nb = mt_list_snapshot(&fifo, (void **)tab, MAX, getref, NULL, flags);
+		for (i = 0; i < nb; i++) {
+			if (i)
+				CHECK(tab[i]->seq == tab[i - 1]->seq + 1);
+			putref(tab[i]);
+		}
+		walks++;
+		/* leave some CPU to the feeders on small machines */
+		usleep(10);
+	}
+	CHECK(walks > 0);
+	return NULL;
+}
+
+static void test_threads()
+{
+	pthread_t thr[THREADS], wthr;
+	struct mt_list *n;
+	unsigned int t;
+	int flags;
+
+	for (flags = 0; flags <= MT_LIST_SNAP_STRICT; flags += MT_LIST_SNAP_STRICT) {
+		stop = 0;
+		pthread_create(&wthr, NULL, walker, (void *)(uintptr_t)flags);
+		for (t = 0; t < THREADS; t++)
+			pthread_create(&thr[t], NULL, feeder, (void *)(uintptr_t)t);
+		for (t = 0; t < THREADS; t++)
+			pthread_join(thr[t], NULL);
+		stop = 1;
+		pthread_join(wthr, NULL);
+
+		while ((n = mt_list_pop(&fifo)))
+			putref(MT_LIST_ELEM(n, struct obj *, list));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	test_single();
+	test_strict();
+	test_threads();
+	return check_done("test-snapshot");
+}
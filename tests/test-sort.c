@@ -0,0 +1,166 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#define USE_THREAD
+#include <mt_list.h>
+#include "check.h"
+
+/* Unit test for mt_list_sort(). Compile this way:
+ *    cc -O2 -o test-sort test-sort.c -I../include -pthread
+ * It sorts lists of various sizes holding many equal keys with 1 to 8
+ * threads, and checks that the result is ordered, stable and complete. Then
+ * it checks that elements appended during a sort remain after the sorted
+ * ones.
+ */
+
+#define MAX_ELEMS  5000
+#define MAX_SORTERS   8
+
+struct elem {
+	struct mt_list list;
+	unsigned int key;
+	unsigned int idx;      /* original position, for stability */
+};
+
+static struct elem elems[MAX_ELEMS];
+static struct mt_list head = MT_LIST_HEAD_INIT(head);
+static volatile int sorting;
+
+static uint32_t rnd32_state = 2463534242U;
+
+/* Xorshift RNG from http://www.jstatsoft.org/v08/i14/paper */
+static inline uint32_t rnd32()
+{
+	rnd32_state ^= rnd32_state << 13;
+	rnd32_state ^= rnd32_state >> 17;
+	rnd32_state ^= rnd32_state << 5;
+	return rnd32_state;
+}
+
+static int cmp(const struct mt_list *a, const struct mt_list *b)
+{
+	const struct elem *ea = MT_LIST_ELEM(a, const struct elem *, list);
+	const struct elem *eb = MT_LIST_ELEM(b, const struct elem *, list);
+
+	return (ea->key > eb->key) - (ea->key < eb->key);
+}
+
+/* Checks that list <lh> contains the <nb> first elements, sorted by key then
+ * by original position, with consistent links.
+ */
+static void check_sorted(struct mt_list *lh, unsigned int nb)
+{
+	const struct elem *e, *prev = NULL;
+	const struct mt_list *n;
+	unsigned int count = 0;
+
+	for (n = lh->next; n != lh; n = n->next) {
+		CHECK(n->next->prev == n);
+		e = MT_LIST_ELEM(n, const struct elem *, list);
+		CHECK(e >= elems && e < elems + nb);
+		if (prev) {
+			CHECK(prev->key <= e->key);
+			if (prev->key == e->key)
+				CHECK(prev->idx < e->idx);
+		}
+		prev = e;
+		if (++count > nb)
+			break;
+	}
+	CHECK(lh->next->prev == lh);
+	CHECK(count == nb);
+}
+
+static void fill(unsigned int nb, unsigned int range)
+{
+	unsigned int i;
+
+	mt_list_init(&head);
+	for (i = 0; i < nb; i++) {
+		elems[i].key = rnd32() % range;
+		elems[i].idx = i;
+		mt_list_append(&head, mt_list_init(&elems[i].list));
+	}
+}
+
+static void test_sizes()
+{
+	static const unsigned int sizes[] = { 0, 1, 2, 3, 5, 16, 17, 100, 1023, MAX_ELEMS };
+	unsigned int s, t, i;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+		for (t = 0; t <= MAX_SORTERS; t++) {
+			/* few distinct keys to check stability */
+			fill(sizes[s], 8);
+			mt_list_sort(&head, cmp, t);
+			check_sorted(&head, sizes[s]);
+
+			/* already sorted then reverse sorted input */
+			mt_list_sort(&head, cmp, t);
+			check_sorted(&head, sizes[s]);
+			mt_list_init(&head);
+			for (i = sizes[s]; i-- > 0; ) {
+				elems[i].key = i;
+				mt_list_append(&head, mt_list_init(&elems[i].list));
+			}
+			mt_list_sort(&head, cmp, t);
+			check_sorted(&head, sizes[s]);
+		}
+	}
+}
+
+/* appends elements once the sort has started */
+static void *appender(void *arg)
+{
+	struct mt_list *added = arg;
+	unsigned int i;
+
+	while (!sorting)
+		usleep(10);
+	for (i = 0; i < 10; i++)
+		mt_list_append(&head, mt_list_init(&added[i]));
+	sorting = 2;
+	return NULL;
+}
+
+/* comparison function which waits for the appender during the first call */
+static int cmp_wait(const struct mt_list *a, const struct mt_list *b)
+{
+	static int started;
+
+	if (!__atomic_exchange_n(&started, 1, __ATOMIC_RELAXED)) {
+		sorting = 1;
+		while (sorting != 2)
+			usleep(10);
+	}
+	return cmp(a, b);
+}
+
+static void test_concurrent()
+{
+	static struct mt_list added[10];
+	struct mt_list *n;
+	unsigned int nb, extra;
+	pthread_t thr;
+
+	fill(MAX_ELEMS, 1000);
+	pthread_create(&thr, NULL, appender, added);
+	mt_list_sort(&head, cmp_wait, 4);
+	pthread_join(thr, NULL);
+
+	/* the sorted elements come first, followed by the added ones */
+	for (nb = 0, n = head.next; n != &head && !(n >= added && n < added + 10); n = n->next)
+		nb++;
+	for (extra = 0; n != &head; n = n->next, extra++)
+		CHECK(n == &added[extra]);
+	CHECK(nb == MAX_ELEMS);
+	CHECK(extra == 10);
+}
+
+int main(int argc, char *argv[])
+{
+	test_sizes();
+	test_concurrent();
+	return check_done("test-sort");
+}
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef MT_LIST_TRACE
+#define MT_LIST_TRACE
+#endif
+#include <mt_list.h>
+#include "bench.h"
+
+/* Offline decoder for traces produced by mt_list_trace_dump(). Compile this
+ * way:
+ *    cc -O2 -o trace-decode trace-decode.c -I../include
+ * It takes the trace file and optionally the number of entries to report in
+ * each ranking (default 10):
+ * ./trace-decode test-list.trace 20
+ *
+ * It reports the number of events and retries per operation, the addresses
+ * which caused the most retries (hot addresses), and the retry storms, which
+ * are sequences of consecutive events of one thread which all had to retry.
+ */
+
+/* minimum number of consecutive retrying events to consider a storm */
+#define STORM_MIN 4
+
+static const char *clk_names[] = {
+	[MT_LIST_TR_CLK_NS]     = "ns",
+	[MT_LIST_TR_CLK_TSC]    = "tsc",
+	[MT_LIST_TR_CLK_CNTVCT] = "cntvct",
+};
+
+/* per-address statistics, in an open addressing hash table */
+struct addr_stat {
+	uint64_t addr;
+	uint64_t events;
+	uint64_t retries;
+};
+
+/* one retry storm */
+struct storm {
+	uint32_t thread;
+	uint32_t events;
+	uint64_t start;
+	uint64_t end;
+	uint64_t retries;
+	uint64_t addr;   /* address involved in the largest number of retries */
+};
+
+static struct addr_stat *addrs;
+static size_t addrs_size;
+
+static struct storm *storms;
+static size_t nb_storms, storms_size;
+
+static struct addr_stat *addr_lookup(uint64_t addr)
+{
+	size_t i = (addr >> 4) * 0x9E3779B97F4A7C15ULL % addrs_size;
+
+	while (addrs[i].events && addrs[i].addr != addr)
+		if (++i == addrs_size)
+			i = 0;
+	addrs[i].addr = addr;
+	return &addrs[i];
+}
+
+static int cmp_addr(const void *a, const void *b)
+{
+	const struct addr_stat *x = a, *y = b;
+
+	return (x->retries < y->retries) - (x->retries > y->retries);
+}
+
+static int cmp_storm(const void *a, const void *b)
+{
+	const struct storm *x = a, *y = b;
+
+	return (x->retries < y->retries) - (x->retries > y->retries);
+}
+
+static void add_storm(const struct storm *s)
+{
+	if (nb_storms == storms_size) {
+		storms_size = storms_size ? storms_size * 2 : 64;
+		storms = realloc(storms, storms_size * sizeof(*storms));
+		if (!storms) {
+			printf("Out of memory.\n");
+			exit(1);
+		}
+	}
+	storms[nb_storms++] = *s;
+}
+
+int main(int argc, char *argv[])
+{
+	struct mt_list_trace_hdr hdr;
+	struct mt_list_trace_thr thr;
+	struct mt_list_trace_ev *ev = NULL;
+	uint64_t op_events[MT_LIST_TR_OPS] = { }, op_retries[MT_LIST_TR_OPS] = { };
+	uint64_t op_max[MT_LIST_TR_OPS] = { };
+	uint64_t first_ts = ~0ULL, total = 0, lost = 0;
+	struct storm cur;
+	unsigned int top = 10;
+	unsigned int t, i, op, max_retries;
+	size_t ev_size = 0;
+	FILE *f;
+
+	if (argc < 2) {
+		printf("Usage: %s <trace_file> [<top>]\n", argv[0]);
+		exit(1);
+	}
+	if (argc > 2)
+		top = atoi(argv[2]);
+
+	f = fopen(argv[1], "r");
+	if (!f) {
+		perror(argv[1]);
+		exit(1);
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, "MTLTRACE", 8) != 0 ||
+	    hdr.version != 1 || hdr.ev_size != sizeof(*ev)) {
+		printf("%s: not a supported trace file.\n", argv[1]);
+		exit(1);
+	}
+
+	/* the table is sized on the fly for the largest possible trace */
+	addrs_size = (size_t)hdr.threads * MT_LIST_TRACE_SIZE * 2 + 1;
+	addrs = calloc(addrs_size, sizeof(*addrs));
+	if (!addrs) {
+		printf("Out of memory.\n");
+		exit(1);
+	}
+
+	for (t = 0; t < hdr.threads; t++) {
+		if (fread(&thr, sizeof(thr), 1, f) != 1) {
+			printf("%s: truncated trace file.\n", argv[1]);
+			exit(1);
+		}
+		if (thr.count > MT_LIST_TRACE_SIZE) {
+			printf("%s: thread %u has too many events (%u).\n", argv[1], thr.thread, thr.count);
+			exit(1);
+		}
+		if (thr.count > ev_size) {
+			ev_size = thr.count;
+			ev = realloc(ev, ev_size * sizeof(*ev));
+			if (!ev) {
+				printf("Out of memory.\n");
+				exit(1);
+			}
+		}
+		if (fread(ev, sizeof(*ev), thr.count, f) != thr.count) {
+			printf("%s: truncated trace file.\n", argv[1]);
+			exit(1);
+		}
+
+		total += thr.count;
+		lost  += thr.total - thr.count;
+		memset(&cur, 0, sizeof(cur));
+		max_retries = 0;
+
+		for (i = 0; i < thr.count; i++) {
+			struct addr_stat *as;
+
+			op = ev[i].op < MT_LIST_TR_OPS ? ev[i].op : 0;
+			op_events[op]++;
+			op_retries[op] += ev[i].retries;
+			if (ev[i].retries > op_max[op])
+				op_max[op] = ev[i].retries;
+			if (ev[i].ts < first_ts)
+				first_ts = ev[i].ts;
+
+			as = addr_lookup(ev[i].addr);
+			as->events++;
+			as->retries += ev[i].retries;
+
+			/* storms: runs of consecutive events which retried */
+			if (ev[i].retries) {
+				if (!cur.events) {
+					cur.thread = thr.thread;
+					cur.start = ev[i].ts;
+					cur.retries = 0;
+					max_retries = 0;
+				}
+				cur.events++;
+				cur.end = ev[i].ts;
+				cur.retries += ev[i].retries;
+				if (ev[i].retries > max_retries) {
+					max_retries = ev[i].retries;
+					cur.addr = ev[i].addr;
+				}
+			}
+			if (!ev[i].retries || i == thr.count - 1) {
+				if (cur.events >= STORM_MIN)
+					add_storm(&cur);
+				cur.events = 0;
+			}
+		}
+	}
+	fclose(f);
+
+	printf("threads: %u, events: %llu (%llu lost), clock: %s\n",
+	       hdr.threads, (unsigned long long)total, (unsigned long long)lost,
+	       hdr.clock < sizeof(clk_names) / sizeof(*clk_names) ? clk_names[hdr.clock] : "unknown");
+
+	printf("\n%-12s %12s %12s %10s %8s\n", "operation", "events", "retries", "retry/evt", "max");
+	for (op = 0; op < MT_LIST_TR_OPS; op++) {
+		if (!op_events[op])
+			continue;
+		printf("%-12s %12llu %12llu %10.3f %8llu\n", bench_op_names[op] ? bench_op_names[op] : "unknown",
+		       (unsigned long long)op_events[op], (unsigned long long)op_retries[op],
+		       (double)op_retries[op] / op_events[op], (unsigned long long)op_max[op]);
+	}
+
+	qsort(addrs, addrs_size, sizeof(*addrs), cmp_addr);
+	printf("\nhot addresses:\n%-18s %12s %12s\n", "address", "events", "retries");
+	for (i = 0; i < top && i < addrs_size && addrs[i].retries; i++)
+		printf("%#-18llx %12llu %12llu\n", (unsigned long long)addrs[i].addr,
+		       (unsigned long long)addrs[i].events, (unsigned long long)addrs[i].retries);
+
+	qsort(storms, nb_storms, sizeof(*storms), cmp_storm);
+	printf("\nretry storms (%llu of at least %u events):\n%-6s %14s %12s %8s %10s %-18s\n",
+	       (unsigned long long)nb_storms, STORM_MIN,
+	       "thread", "start", "duration", "events", "retries", "hottest address");
+	for (i = 0; i < top && i < nb_storms; i++)
+		printf("%-6u %14llu %12llu %8u %10llu %#-18llx\n", storms[i].thread,
+		       (unsigned long long)(storms[i].start - first_ts),
+		       (unsigned long long)(storms[i].end - storms[i].start),
+		       storms[i].events, (unsigned long long)storms[i].retries,
+		       (unsigned long long)storms[i].addr);
+	return 0;
+}